@@ -0,0 +1,225 @@
+#include "ChangeFeed.h"
+
+static std::size_t round_up_pow2(std::size_t n) {
+    std::size_t p = 2;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+ChangeFeed::ChangeFeed(std::size_t capacity)
+    : epoch_(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::system_clock::now().time_since_epoch()).count())),
+      slots_(new Slot[round_up_pow2(capacity)]),
+      mask_(round_up_pow2(capacity) - 1),
+      sweeper_(&ChangeFeed::sweep_loop, this) {}
+
+ChangeFeed::~ChangeFeed() {
+    shutdown();
+}
+
+void ChangeFeed::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(waitersMutex_);
+        if (stopping_) {
+            return;
+        }
+        stopping_ = true;
+    }
+    sweepCv_.notify_all();
+    sweeper_.join();
+
+    // wait() no longer parks anyone, so this empties the list for good
+    std::vector<Waiter> parked;
+    {
+        std::lock_guard<std::mutex> lock(waitersMutex_);
+        parked.swap(waiters_);
+        waiterCount_.fetch_sub(parked.size(), std::memory_order_seq_cst);
+    }
+    for (auto& w : parked) {
+        w.ready();
+    }
+}
+
+std::string ChangeFeed::cursor(std::uint64_t seq) const {
+    return std::to_string(epoch_) + "-" + std::to_string(seq);
+}
+
+bool ChangeFeed::parse_cursor(const std::string& text, std::uint64_t& seq, bool& current) const {
+    auto parse_number = [](const std::string& digits, std::uint64_t& value) {
+        if (digits.empty() || digits.size() > 19 ||
+            digits.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        value = std::stoull(digits);
+        return true;
+    };
+
+    std::size_t dash = text.find('-');
+    if (dash == std::string::npos) {
+        current = false;
+        return parse_number(text, seq);
+    }
+
+    std::uint64_t epoch = 0;
+    if (!parse_number(text.substr(0, dash), epoch) || !parse_number(text.substr(dash + 1), seq)) {
+        return false;
+    }
+    current = epoch == epoch_;
+    return true;
+}
+
+std::uint64_t ChangeFeed::publish(ChangeEntity entity, long long id, ChangeOp op, long long version) {
+    std::uint64_t seq = next_.fetch_add(1) + 1;
+    Slot& slot = slots_[seq & mask_];
+
+    // Claim the slot. A writer from a later lap may already own it, in which
+    // case this event is dropped; readers that needed it get a resync.
+    std::uint64_t cur = slot.stamp.load(std::memory_order_acquire);
+    for (;;) {
+        if ((cur & ~kBusy) > seq) {
+            return seq;
+        }
+        if (cur & kBusy) {
+            std::this_thread::yield();
+            cur = slot.stamp.load(std::memory_order_acquire);
+            continue;
+        }
+        if (slot.stamp.compare_exchange_weak(cur, seq | kBusy, std::memory_order_acq_rel)) {
+            break;
+        }
+    }
+
+    slot.entity.store(static_cast<std::uint8_t>(entity), std::memory_order_relaxed);
+    slot.op.store(static_cast<std::uint8_t>(op), std::memory_order_relaxed);
+    slot.id.store(id, std::memory_order_relaxed);
+    slot.version.store(version, std::memory_order_relaxed);
+    slot.stamp.store(seq, std::memory_order_seq_cst);
+
+    // Pairs with the increment in wait(): either we see the waiter or it sees the event.
+    // Waiters are completed on the sweeper thread, never on the publishing (writer) thread.
+    if (waiterCount_.load(std::memory_order_seq_cst) > 0) {
+        {
+            std::lock_guard<std::mutex> lock(waitersMutex_);
+            wakePending_ = true;
+        }
+        sweepCv_.notify_one();
+    }
+    return seq;
+}
+
+std::uint64_t ChangeFeed::head() const {
+    return next_.load(std::memory_order_acquire);
+}
+
+bool ChangeFeed::read_since(std::uint64_t since, std::size_t max, std::vector<ChangeEvent>& out) const {
+    std::uint64_t last = head();
+    if (since > last || last - since > capacity()) {
+        return false;
+    }
+
+    for (std::uint64_t seq = since + 1; seq <= last && max > 0; ++seq, --max) {
+        const Slot& slot = slots_[seq & mask_];
+
+        std::uint64_t before = slot.stamp.load(std::memory_order_acquire);
+        if ((before & ~kBusy) > seq) {
+            return false;   // overwritten by a later lap
+        }
+        if (before != seq) {
+            break;          // still being written; stop at the gap
+        }
+
+        ChangeEvent ev;
+        ev.seq = seq;
+        ev.entity = static_cast<ChangeEntity>(slot.entity.load(std::memory_order_relaxed));
+        ev.op = static_cast<ChangeOp>(slot.op.load(std::memory_order_relaxed));
+        ev.id = slot.id.load(std::memory_order_relaxed);
+        ev.version = slot.version.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.stamp.load(std::memory_order_relaxed) != seq) {
+            return false;
+        }
+
+        out.push_back(ev);
+    }
+    return true;
+}
+
+bool ChangeFeed::has_event_after(std::uint64_t since) const {
+    std::uint64_t seq = since + 1;
+    if (seq > head()) {
+        return false;
+    }
+    // Published, or already overwritten (the waiter will then get a resync)
+    std::uint64_t stamp = slots_[seq & mask_].stamp.load(std::memory_order_seq_cst);
+    return stamp == seq || (stamp & ~kBusy) > seq;
+}
+
+void ChangeFeed::wait(std::uint64_t since, std::chrono::milliseconds timeout, std::function<void()> ready) {
+    {
+        std::lock_guard<std::mutex> lock(waitersMutex_);
+        waiterCount_.fetch_add(1, std::memory_order_seq_cst);
+
+        if (!has_event_after(since) && !stopping_) {
+            waiters_.push_back({since, std::chrono::steady_clock::now() + timeout, std::move(ready)});
+            return;
+        }
+        waiterCount_.fetch_sub(1, std::memory_order_seq_cst);
+    }
+    ready();
+}
+
+// Moves the waiters whose event has arrived (or whose deadline passed) into `due`;
+// caller holds waitersMutex_
+void ChangeFeed::take_due_waiters(bool checkEvents, std::chrono::steady_clock::time_point now,
+                                  std::vector<std::function<void()>>& due) {
+    for (size_t i = 0; i < waiters_.size();) {
+        if (waiters_[i].deadline <= now || (checkEvents && has_event_after(waiters_[i].since))) {
+            due.push_back(std::move(waiters_[i].ready));
+            waiters_[i] = std::move(waiters_.back());
+            waiters_.pop_back();
+            waiterCount_.fetch_sub(1, std::memory_order_seq_cst);
+        } else {
+            ++i;
+        }
+    }
+}
+
+void ChangeFeed::sweep_loop() {
+    std::unique_lock<std::mutex> lock(waitersMutex_);
+    while (!stopping_) {
+        sweepCv_.wait_for(lock, std::chrono::milliseconds(200),
+                          [this] { return stopping_ || wakePending_; });
+
+        bool checkEvents = wakePending_;
+        wakePending_ = false;
+
+        std::vector<std::function<void()>> due;
+        take_due_waiters(checkEvents, std::chrono::steady_clock::now(), due);
+
+        if (!due.empty()) {
+            lock.unlock();
+            for (auto& ready : due) {
+                ready();
+            }
+            lock.lock();
+        }
+    }
+}
+
+const char* ChangeFeed::entity_name(ChangeEntity entity) {
+    switch (entity) {
+        case ChangeEntity::User:    return "user";
+        case ChangeEntity::Account: return "account";
+    }
+    return "unknown";
+}
+
+const char* ChangeFeed::op_name(ChangeOp op) {
+    switch (op) {
+        case ChangeOp::Create: return "create";
+        case ChangeOp::Update: return "update";
+        case ChangeOp::Delete: return "delete";
+    }
+    return "unknown";
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class ChangeEntity : std::uint8_t { User, Account };
+enum class ChangeOp : std::uint8_t { Create, Update, Delete };
+
+struct ChangeEvent {
+    std::uint64_t seq;
+    ChangeEntity entity;
+    long long id;
+    ChangeOp op;
+    long long version;
+};
+
+// Bounded feed of recent mutations. Publishing is lock-free: each slot is a
+// small seqlock stamped with its sequence number, so readers detect both
+// not-yet-written and already-overwritten slots. Only long-poll waiters take
+// a mutex, and only when someone is actually waiting. Waiters are completed
+// on the feed's own sweeper thread, so a publishing writer never pays for them.
+//
+// Sequence numbers restart with the process, so cursors handed to clients are
+// "<epoch>-<seq>", where the epoch is fixed at construction (the boot time in
+// microseconds). A cursor from another epoch always means resync.
+class ChangeFeed {
+public:
+    explicit ChangeFeed(std::size_t capacity = 4096);
+    ~ChangeFeed();
+
+    ChangeFeed(const ChangeFeed&) = delete;
+    ChangeFeed& operator=(const ChangeFeed&) = delete;
+
+    std::uint64_t publish(ChangeEntity entity, long long id, ChangeOp op, long long version);
+
+    // Highest sequence number handed out so far (0 before the first event)
+    std::uint64_t head() const;
+
+    std::size_t capacity() const { return mask_ + 1; }
+
+    std::uint64_t epoch() const { return epoch_; }
+
+    // "<epoch>-<seq>" for this feed
+    std::string cursor(std::uint64_t seq) const;
+
+    // Splits a client cursor. False if it is malformed; otherwise `seq` is its
+    // sequence number and `current` says whether it belongs to this epoch (a
+    // bare number, from before epochs, never does).
+    bool parse_cursor(const std::string& text, std::uint64_t& seq, bool& current) const;
+
+    // Appends up to `max` events with seq > since. Returns false when `since`
+    // is no longer covered by the buffer and the caller must resync.
+    bool read_since(std::uint64_t since, std::size_t max, std::vector<ChangeEvent>& out) const;
+
+    // Runs `ready` once an event after `since` is readable or `timeout`
+    // expires, whichever is first. Never blocks the calling thread; `ready`
+    // runs inline only if the event is already there, else on the sweeper thread.
+    // After shutdown() it always runs inline.
+    void wait(std::uint64_t since, std::chrono::milliseconds timeout, std::function<void()> ready);
+
+    // Stops the sweeper and runs every parked `ready` right away (they then see
+    // whatever is in the buffer, usually an empty batch). Call before stopping
+    // the server so no long-poll is left without a response. Idempotent; the
+    // destructor calls it.
+    void shutdown();
+
+    static const char* entity_name(ChangeEntity entity);
+    static const char* op_name(ChangeOp op);
+
+private:
+    static constexpr std::uint64_t kBusy = 1ULL << 63;
+
+    struct Slot {
+        std::atomic<std::uint64_t> stamp{0};
+        std::atomic<std::uint8_t> entity{0};
+        std::atomic<std::uint8_t> op{0};
+        std::atomic<long long> id{0};
+        std::atomic<long long> version{0};
+    };
+
+    struct Waiter {
+        std::uint64_t since;
+        std::chrono::steady_clock::time_point deadline;
+        std::function<void()> ready;
+    };
+
+    bool has_event_after(std::uint64_t since) const;
+    void take_due_waiters(bool checkEvents, std::chrono::steady_clock::time_point now,
+                          std::vector<std::function<void()>>& due);
+    void sweep_loop();
+
+    std::uint64_t epoch_;
+    std::unique_ptr<Slot[]> slots_;
+    std::size_t mask_;
+    std::atomic<std::uint64_t> next_{0};
+
+    std::atomic<std::size_t> waiterCount_{0};
+    std::mutex waitersMutex_;
+    std::vector<Waiter> waiters_;
+
+    bool stopping_ = false;
+    bool wakePending_ = false;      // an event was published while someone waited
+    std::condition_variable sweepCv_;
+    std::thread sweeper_;
+};
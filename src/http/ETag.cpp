@@ -0,0 +1,31 @@
+#include "ETag.h"
+
+std::string ETag::make(const std::string& tag, long long version) {
+    return "\"" + tag + "-v" + std::to_string(version) + "\"";
+}
+
+bool ETag::matches(const std::string& header, const std::string& etag) {
+    if (header.empty()) {
+        return false;
+    }
+
+    size_t pos = 0;
+    while (pos < header.size()) {
+        size_t comma = header.find(',', pos);
+        if (comma == std::string::npos) comma = header.size();
+
+        size_t start = header.find_first_not_of(" \t", pos);
+        size_t end = header.find_last_not_of(" \t", comma - 1);
+        if (start != std::string::npos && start < comma && end != std::string::npos && end >= start) {
+            std::string candidate = header.substr(start, end - start + 1);
+            if (candidate.rfind("W/", 0) == 0) {
+                candidate = candidate.substr(2);
+            }
+            if (candidate == "*" || candidate == etag) {
+                return true;
+            }
+        }
+        pos = comma + 1;
+    }
+    return false;
+}
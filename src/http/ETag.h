@@ -0,0 +1,13 @@
+#pragma once
+#include <string>
+
+// Entity tags for conditional GET. Tags are strong and derived from a row or
+// collection version, so they change exactly when the data does.
+class ETag {
+public:
+    // Strong ETag for a versioned resource, e.g. "user-3-v7"
+    static std::string make(const std::string& tag, long long version);
+
+    // If-None-Match may be "*" or a comma separated list (weak comparison per RFC 9110)
+    static bool matches(const std::string& ifNoneMatch, const std::string& etag);
+};
@@ -1,95 +1,441 @@
 #include "crow_all.h"
 #include "repository/Database.h"
+#include "repository/Backup.h"
+#include "repository/ShardSet.h"
+#include "repository/ExistenceIndex.h"
+#include "repository/HealthProbe.h"
+#include "repository/DbExecutor.h"
+#include "repository/Warmup.h"
+#include "repository/Maintenance.h"
+#include "events/ChangeFeed.h"
+#include "http/ETag.h"
+#include "memory/RequestArena.h"
+#include "memory/AllocationCounter.h"
+#include "tracing/Tracer.h"
+#include "profiling/Profiler.h"
 
 #include <sqlite3.h>
 #include <string>
 #include <vector>
 #include <algorithm>
 #include <cctype>
+#include <cmath>
 #include <cstdlib>   // getenv
+#include <filesystem>
 #include <fstream>
+#include <map>
+#include <memory_resource>
 #include <sstream>
+#include <string_view>
+
+#include <arpa/inet.h>
+#include <csignal>   // sigwait, kill
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Serializes `out` as the response body (the "serialize" phase of a trace)
+static void write_json(crow::response& res, const crow::json::wvalue& out) {
+    ScopedSpan span("serialize");
+    res.write(out.dump());
+}
+
+// Parses the request body (the "parse" phase of a trace)
+static crow::json::rvalue parse_body(const crow::request& req) {
+    ScopedSpan span("parse");
+    return crow::json::load(req.body);
+}
 
 static crow::response json_error(int code, const std::string& msg) {
     crow::json::wvalue out;
     out["error"] = msg;
     crow::response res(code);
     res.set_header("Content-Type", "application/json");
-    res.write(out.dump());
+    write_json(res, out);
     return res;
 }
 
-static bool user_exists(sqlite3* db, int userId) {
-    const char* sql = "SELECT 1 FROM users WHERE id = ?;";
-    sqlite3_stmt* stmt = nullptr;
-
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        return false;
-    }
+static bool etag_matches(const crow::request& req, const std::string& etag) {
+    return ETag::matches(req.get_header_value("If-None-Match"), etag);
+}
 
-    sqlite3_bind_int(stmt, 1, userId);
-    int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+static void set_etag(crow::response& res, const std::string& etag) {
+    res.set_header("ETag", etag);
+    // Let browsers keep the body but revalidate on every use
+    res.set_header("Cache-Control", "no-cache");
+}
 
-    return (rc == SQLITE_ROW);
+static crow::response not_modified(const std::string& etag) {
+    crow::response res(304);
+    set_etag(res, etag);
+    return res;
 }
 
-static bool account_exists(sqlite3* db, int accountId) {
-    const char* sql = "SELECT 1 FROM accounts WHERE id = ?;";
+// Combined version of a whole table, maintained by triggers (see Database::init)
+static long long entity_version(sqlite3* db, const char* entity) {
+    const char* sql = "SELECT version FROM entity_versions WHERE entity = ?;";
     sqlite3_stmt* stmt = nullptr;
 
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        return false;
+        return -1;
     }
 
-    sqlite3_bind_int(stmt, 1, accountId);
-    int rc = sqlite3_step(stmt);
+    sqlite3_bind_text(stmt, 1, entity, -1, SQLITE_STATIC);
+
+    long long version = -1;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        version = sqlite3_column_int64(stmt, 0);
+    }
     sqlite3_finalize(stmt);
 
-    return (rc == SQLITE_ROW);
+    return version;
 }
 
-// Trim leading/trailing whitespace
-static std::string trim(const std::string& s) {
+// Sum over every shard: it moves whenever any shard's table changes
+static long long entity_version(const ShardSet& shards, const char* entity) {
+    long long total = 0;
+    for (size_t i = 0; i < shards.size(); ++i) {
+        long long version = entity_version(shards.shard(i), entity);
+        if (version < 0) {
+            return -1;
+        }
+        total += version;
+    }
+    return total;
+}
+
+// Trim leading/trailing whitespace without copying
+static std::string_view trim_view(std::string_view s) {
     size_t start = s.find_first_not_of(" \t\n\r");
     size_t end   = s.find_last_not_of(" \t\n\r");
-    if (start == std::string::npos) return "";
+    if (start == std::string_view::npos) return {};
     return s.substr(start, end - start + 1);
 }
 
+static std::string trim(const std::string& s) {
+    return std::string(trim_view(s));
+}
+
+// String value of a JSON field as a view into the parsed request body
+static std::string_view json_text(const crow::json::rvalue& v) {
+    auto r = v.s();
+    return std::string_view(r.begin(), r.size());
+}
+
+static void bind_text(sqlite3_stmt* stmt, int idx, std::string_view text) {
+    sqlite3_bind_text(stmt, idx, text.data(), static_cast<int>(text.size()), SQLITE_TRANSIENT);
+}
+
 // Very basic email check 
-static bool is_valid_email(const std::string& email) {
+static bool is_valid_email(std::string_view email) {
     size_t at = email.find('@');
-    size_t dot = email.find('.', at == std::string::npos ? 0 : at);
-    return at != std::string::npos &&
-           dot != std::string::npos &&
+    size_t dot = email.find('.', at == std::string_view::npos ? 0 : at);
+    return at != std::string_view::npos &&
+           dot != std::string_view::npos &&
            at > 0 &&
            dot > at + 1 &&
            dot < email.length() - 1;
 }
 
-static bool is_allowed_account_type(const std::string& type) {
+static bool is_allowed_account_type(std::string_view type) {
     return type == "checking" || type == "savings";
 }
 
-static bool is_allowed_account_status(const std::string& status) {
+static bool is_allowed_account_status(std::string_view status) {
     return status == "active" || status == "locked";
 }
 
-static bool user_has_accounts(sqlite3* db, int userId) {
-    const char* sql = "SELECT 1 FROM accounts WHERE userId = ? LIMIT 1;";
+// Largest single ledger delta and largest balance accepted (keeps balanceCents
+// far from int64 overflow)
+static const long long kMaxTransactionCents = 100000000000LL;
+
+// Balances are stored as integer cents; REAL `balance` is only a mirror.
+// False for amounts outside +/- kMaxTransactionCents, which llround cannot be trusted with.
+static bool to_cents(double amount, long long& cents) {
+    double scaled = amount * 100.0;
+    if (!std::isfinite(scaled) || std::fabs(scaled) > static_cast<double>(kMaxTransactionCents)) {
+        return false;
+    }
+    cents = std::llround(scaled);
+    return true;
+}
+
+// Current row version; used after writes whose version is bumped by a trigger
+static long long account_version(sqlite3* db, int accountId) {
+    const char* sql = "SELECT version FROM accounts WHERE id = ?;";
     sqlite3_stmt* stmt = nullptr;
 
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return 0;
+    }
+
+    sqlite3_bind_int(stmt, 1, accountId);
+
+    long long version = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        version = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+
+    return version;
+}
+
+// Columns a client may ask for with ?fields= on user reads
+static const std::vector<std::string> kUserFields = {
+    "id", "firstName", "lastName", "email", "createdAt", "updatedAt", "version"
+};
+
+// Allocator-aware so listings can keep every row in the request arena
+struct UserRow {
+    using allocator_type = std::pmr::polymorphic_allocator<char>;
+
+    int id = 0;
+    std::pmr::string firstName;
+    std::pmr::string lastName;
+    std::pmr::string email;
+    std::pmr::string createdAt;
+    std::pmr::string updatedAt;
+    long long version = 0;
+
+    explicit UserRow(const allocator_type& alloc = {})
+        : firstName(alloc), lastName(alloc), email(alloc), createdAt(alloc), updatedAt(alloc) {}
+
+    UserRow(const UserRow& other, const allocator_type& alloc)
+        : id(other.id),
+          firstName(other.firstName, alloc), lastName(other.lastName, alloc),
+          email(other.email, alloc), createdAt(other.createdAt, alloc),
+          updatedAt(other.updatedAt, alloc), version(other.version) {}
+
+    UserRow(UserRow&& other, const allocator_type& alloc)
+        : id(other.id),
+          firstName(std::move(other.firstName), alloc), lastName(std::move(other.lastName), alloc),
+          email(std::move(other.email), alloc), createdAt(std::move(other.createdAt), alloc),
+          updatedAt(std::move(other.updatedAt), alloc), version(other.version) {}
+
+    UserRow(const UserRow&) = default;
+    UserRow(UserRow&&) = default;
+    UserRow& operator=(const UserRow&) = default;
+    UserRow& operator=(UserRow&&) = default;
+};
+
+// Text columns map onto a UserRow member; id and version are integers
+static std::pmr::string UserRow::* user_text_member(const std::string& field) {
+    if (field == "firstName") return &UserRow::firstName;
+    if (field == "lastName")  return &UserRow::lastName;
+    if (field == "email")     return &UserRow::email;
+    if (field == "createdAt") return &UserRow::createdAt;
+    if (field == "updatedAt") return &UserRow::updatedAt;
+    return nullptr;
+}
+
+// The subset of user columns a query actually reads, in SELECT order
+struct UserProjection {
+    std::vector<std::string> columns;
+    std::vector<std::pmr::string UserRow::*> members;
+
+    void add(const std::string& field) {
+        if (std::find(columns.begin(), columns.end(), field) != columns.end()) return;
+        columns.push_back(field);
+        members.push_back(user_text_member(field));
+    }
+
+    std::string select_list() const {
+        std::string out;
+        for (size_t c = 0; c < columns.size(); ++c) {
+            if (c > 0) out += ", ";
+            out += columns[c];
+        }
+        return out;
+    }
+
+    void read(sqlite3_stmt* stmt, UserRow& row) const {
+        for (size_t c = 0; c < columns.size(); ++c) {
+            int col = static_cast<int>(c);
+            if (members[c]) {
+                const unsigned char* text = sqlite3_column_text(stmt, col);
+                row.*members[c] = text ? reinterpret_cast<const char*>(text) : "";
+            } else if (columns[c] == "id") {
+                row.id = sqlite3_column_int(stmt, col);
+            } else {
+                row.version = sqlite3_column_int64(stmt, col);
+            }
+        }
+    }
+};
+
+static void write_user_fields(const UserRow& u, const std::vector<std::string>& fields,
+                              crow::json::wvalue& j) {
+    for (const auto& f : fields) {
+        if (f == "id") {
+            j["id"] = u.id;
+        } else if (f == "version") {
+            j["version"] = u.version;
+        } else {
+            j[f] = (u.*user_text_member(f)).c_str();
+        }
+    }
+}
+
+// ?fields=a,b -> whitelisted, de-duplicated list; missing/empty means all of `allowed`
+static bool parse_fields(const char* param, const std::vector<std::string>& allowed,
+                         std::vector<std::string>& out, std::string& unknown) {
+    out.clear();
+    if (!param || !*param) {
+        out = allowed;
+        return true;
+    }
+
+    std::stringstream ss(param);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        item = trim(item);
+        if (item.empty()) continue;
+        if (std::find(allowed.begin(), allowed.end(), item) == allowed.end()) {
+            unknown = item;
+            return false;
+        }
+        if (std::find(out.begin(), out.end(), item) == out.end()) {
+            out.push_back(item);
+        }
+    }
+
+    if (out.empty()) {
+        out = allowed;
+    }
+    return true;
+}
+
+// ?include=accounts is the only embedding supported
+static bool parse_include_accounts(const char* param, bool& includeAccounts) {
+    includeAccounts = false;
+    if (!param || !*param) return true;
+
+    std::string value = trim(param);
+    if (value == "accounts") {
+        includeAccounts = true;
+        return true;
+    }
+    return false;
+}
+
+// Column order expected by account_json()
+static constexpr const char* kAccountColumns =
+    "id, userId, type, status, balance, createdAt, updatedAt, version, balanceCents";
+
+static crow::json::wvalue account_json(sqlite3_stmt* stmt) {
+    crow::json::wvalue a;
+    a["id"] = sqlite3_column_int(stmt, 0);
+    a["userId"] = sqlite3_column_int(stmt, 1);
+    a["type"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+    a["status"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
+    a["balance"] = sqlite3_column_double(stmt, 4);
+    a["createdAt"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5));
+    a["updatedAt"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 6));
+    a["version"] = sqlite3_column_int64(stmt, 7);
+    a["balanceCents"] = sqlite3_column_int64(stmt, 8);
+    return a;
+}
+
+// Ids are bound as one JSON array and expanded with json_each(), so the
+// statement text is the same for any number of ids
+static std::string ids_to_json_array(const std::vector<int>& ids) {
+    std::string out = "[";
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (i > 0) out += ",";
+        out += std::to_string(ids[i]);
+    }
+    out += "]";
+    return out;
+}
+
+// Loads the accounts of every user in `userIds` with one query
+static bool load_accounts_for_users(sqlite3* db, const std::vector<int>& userIds,
+                                    std::map<int, std::vector<crow::json::wvalue>>& out) {
+    if (userIds.empty()) return true;
+
+    // One statement for any page size, and never near SQLite's bound-parameter limit
+    static const std::string sql = std::string("SELECT ") + kAccountColumns +
+        " FROM accounts WHERE userId IN (SELECT value FROM json_each(?)) ORDER BY userId, id;";
+
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
         return false;
     }
 
-    sqlite3_bind_int(stmt, 1, userId);
+    std::string idsJson = ids_to_json_array(userIds);
+    sqlite3_bind_text(stmt, 1, idsJson.c_str(), -1, SQLITE_TRANSIENT);
 
-    int rc = sqlite3_step(stmt);
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        out[sqlite3_column_int(stmt, 1)].push_back(account_json(stmt));
+    }
     sqlite3_finalize(stmt);
 
-    return (rc == SQLITE_ROW);
+    return rc == SQLITE_DONE;
+}
+
+// Same, one query per shard that holds any of the users
+static bool load_accounts_for_users(const ShardSet& shards, const std::vector<int>& userIds,
+                                    std::map<int, std::vector<crow::json::wvalue>>& out) {
+    if (!shards.sharded()) {
+        return load_accounts_for_users(shards.shard(0), userIds, out);
+    }
+
+    std::vector<std::vector<int>> byShard(shards.size());
+    for (int id : userIds) {
+        byShard[shards.shard_of_user(id)].push_back(id);
+    }
+    for (size_t i = 0; i < shards.size(); ++i) {
+        if (!load_accounts_for_users(shards.shard(i), byShard[i], out)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Highest MULTI_GET_MAX_IDS accepted
+static const long kMaxMultiGetIdsLimit = 1000;
+
+// ?ids=1,2,3 -> ids in request order (duplicates kept), at most `maxIds`
+static bool parse_id_list(const char* param, size_t maxIds, std::vector<int>& out, std::string& err) {
+    out.clear();
+    std::stringstream ss(param ? param : "");
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        item = trim(item);
+        if (item.empty()) continue;
+
+        size_t used = 0;
+        int id = 0;
+        try {
+            id = std::stoi(item, &used);
+        } catch (...) {
+            used = 0;
+        }
+        if (used != item.size() || id < 1) {
+            err = "Invalid id in ids: " + item;
+            return false;
+        }
+
+        if (out.size() == maxIds) {
+            err = "ids accepts at most " + std::to_string(maxIds) + " ids";
+            return false;
+        }
+        out.push_back(id);
+    }
+
+    if (out.empty()) {
+        err = "ids cannot be empty";
+        return false;
+    }
+    return true;
+}
+
+static crow::json::wvalue not_found_marker(int id, const char* msg) {
+    crow::json::wvalue j;
+    j["id"] = id;
+    j["error"] = msg;
+    return j;
 }
 
 static const char* method_to_string(crow::HTTPMethod method) {
@@ -104,16 +450,41 @@ static const char* method_to_string(crow::HTTPMethod method) {
     }
 }
 
+// Gives back the request's arena (see RequestArena) once the response is done.
+// The arena itself is taken lazily by request_memory(), on the thread that runs
+// the handler, so requests waiting in the DbExecutor queue hold none.
+struct ArenaMiddleware {
+    struct context {
+        RequestArena* arena = nullptr;
+    };
+
+    void before_handle(crow::request&, crow::response&, context&) {}
+
+    void after_handle(crow::request&, crow::response&, context& ctx) {
+        RequestArena::release(ctx.arena);
+        ctx.arena = nullptr;
+    }
+};
+
 struct RequestLogger {
     struct context {
         std::chrono::steady_clock::time_point start;
+        RequestTrace* trace = nullptr;
     };
 
+    // Set in main() before the app runs; requests are untraced without it
+    Tracer* tracer = nullptr;
+
     void before_handle(crow::request& req, crow::response&, context& ctx) {
+        if (tracer) {
+            ctx.trace = tracer->begin(method_to_string(req.method), req.url);
+        }
         ctx.start = std::chrono::steady_clock::now();
     }
 
-    void after_handle(crow::request& req, crow::response& res, context& ctx) {
+    // Runs before ArenaMiddleware::after_handle, so the arena stats are still intact
+    template <typename AllContext>
+    void after_handle(crow::request& req, crow::response& res, context& ctx, AllContext& all) {
         auto end = std::chrono::steady_clock::now();
         auto duration =
             std::chrono::duration_cast<std::chrono::milliseconds>(end - ctx.start).count();
@@ -125,11 +496,196 @@ struct RequestLogger {
             << method_to_string(req.method) << " "
             << req.url << " "
             << res.code << " "
-            << duration << "ms"
-            << std::endl;
+            << duration << "ms";
+
+        RequestArena* arena = all.template get<ArenaMiddleware>().arena;
+        if (arena) {
+            std::cout
+                << " arenaAllocs=" << arena->allocations()
+                << " arenaBytes=" << arena->bytes();
+        }
+        std::cout << std::endl;
+
+        if (tracer) {
+            tracer->end(ctx.trace, res.code);
+            ctx.trace = nullptr;
+        }
     }
 };
 
+// Middleware order matters: RequestLogger's after_handle runs first
+using App = crow::App<ArenaMiddleware, RequestLogger>;
+
+// Memory for a request's temporaries, from an arena of the calling thread
+static std::pmr::memory_resource* request_memory(App& app, const crow::request& req) {
+    RequestArena*& arena = app.get_context<ArenaMiddleware>(req).arena;
+    if (!arena) {
+        arena = RequestArena::acquire();
+    }
+    return arena;
+}
+
+// Runs a route body on the database executor and completes `res` with what it
+// returns; the I/O thread is free as soon as the job is queued. A full queue
+// is answered with 503 straight away.
+template <typename Handler>
+static void run_db(DbExecutor& executor, DbExecutor::Kind kind, crow::response& res, Handler handler) {
+    RequestTrace* trace = Tracer::current();
+    std::uint64_t queuedUs = Tracer::now_us();
+
+    bool queued = executor.submit(kind, [&res, trace, queuedUs, handler]() {
+        TraceScope scope(trace);
+        if (trace && trace->sampled) {
+            trace->spans.push_back({"queue", queuedUs, Tracer::now_us() - queuedUs});
+        }
+
+        try {
+            res = handler();
+        } catch (const std::exception& e) {
+            std::cerr << "Handler failed: " << e.what() << std::endl;
+            res = json_error(500, "Internal server error");
+        }
+        res.end();
+    });
+
+    if (!queued) {
+        res = json_error(503, "Server busy, retry later");
+        res.set_header("Retry-After", "1");
+        res.end();
+    }
+}
+
+// Completes a GET /changes request with everything after `since`, either as
+// Server-Sent Events or as a JSON long-poll batch. `current` is false for a
+// cursor from another epoch (an earlier run of the server).
+static void finish_changes(const ChangeFeed& changes, crow::response& res,
+                           std::uint64_t since, bool current, size_t limit, bool sse) {
+    std::vector<ChangeEvent> events;
+    bool inRange = current && changes.read_since(since, limit, events);
+    std::uint64_t next = since;
+    if (!events.empty()) next = events.back().seq;
+
+    // Too far behind (or from before a restart): client must reload and resume from head
+    std::uint64_t head = changes.head();
+
+    res.code = 200;
+    res.set_header("Cache-Control", "no-cache");
+
+    if (sse) {
+        std::string body = "retry: 1000\n\n";
+        if (!inRange) {
+            body += "id: " + changes.cursor(head) + "\nevent: resync\ndata: {\"next\":\"" +
+                    changes.cursor(head) + "\"}\n\n";
+        }
+        for (const auto& e : events) {
+            crow::json::wvalue j;
+            j["seq"] = e.seq;
+            j["entity"] = ChangeFeed::entity_name(e.entity);
+            j["id"] = e.id;
+            j["op"] = ChangeFeed::op_name(e.op);
+            j["version"] = e.version;
+            body += "id: " + changes.cursor(e.seq) + "\nevent: change\ndata: " + j.dump() + "\n\n";
+        }
+        if (inRange && events.empty()) {
+            // No event, but pin Last-Event-ID so the reconnect resumes from here
+            body += "id: " + changes.cursor(since) + "\n\n";
+        }
+        res.set_header("Content-Type", "text/event-stream");
+        res.write(body);
+        res.end();
+        return;
+    }
+
+    crow::json::wvalue out;
+    out["resync"] = !inRange;
+    out["next"] = changes.cursor(inRange ? next : head);
+    out["events"] = crow::json::wvalue::list();
+
+    int i = 0;
+    for (const auto& e : events) {
+        crow::json::wvalue j;
+        j["seq"] = e.seq;
+        j["entity"] = ChangeFeed::entity_name(e.entity);
+        j["id"] = e.id;
+        j["op"] = ChangeFeed::op_name(e.op);
+        j["version"] = e.version;
+        out["events"][i++] = std::move(j);
+    }
+
+    res.set_header("Content-Type", "application/json");
+    write_json(res, out);
+    res.end();
+}
+
+// Numeric setting from the environment, falling back on missing/invalid values
+static long env_long(const char* name, long fallback) {
+    const char* value = std::getenv(name);
+    if (!value) {
+        return fallback;
+    }
+    try {
+        return std::stol(value);
+    } catch (...) {
+        std::cerr << "Invalid " << name << " value, using default " << fallback << "\n";
+        return fallback;
+    }
+}
+
+// Admin and debug routes need ADMIN_TOKEN to be set and X-Admin-Token to match it
+static bool admin_authorized(const crow::request& req, const std::string& adminToken) {
+    return !adminToken.empty() && req.get_header_value("X-Admin-Token") == adminToken;
+}
+
+static crow::response admin_denied(const std::string& adminToken) {
+    if (adminToken.empty()) {
+        return json_error(403, "Admin routes are disabled (set ADMIN_TOKEN)");
+    }
+    return json_error(401, "Invalid admin token");
+}
+
+// Issues one GET against this server and drains the reply (startup warm-up only)
+static bool local_get(int port, const std::string& path) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    bool ok = connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    if (ok) {
+        std::string request = "GET " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n";
+        ok = send(fd, request.data(), request.size(), 0) == static_cast<ssize_t>(request.size());
+    }
+
+    char buffer[4096];
+    while (ok && recv(fd, buffer, sizeof(buffer), 0) > 0) {
+    }
+
+    close(fd);
+    return ok;
+}
+
+// Smallest id in `table`, or 0 if it is empty
+static int first_id(sqlite3* db, const char* table) {
+    std::string sql = std::string("SELECT min(id) FROM ") + table + ";";
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        return 0;
+    }
+
+    int id = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
+        id = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+
+    return id;
+}
+
 static crow::response serve_file(const std::string& path, const std::string& contentType) {
     std::ifstream file(path, std::ios::binary);
     if (!file) {
@@ -146,17 +702,159 @@ static crow::response serve_file(const std::string& path, const std::string& con
 }
 
 int main() {
+    // SIGINT / SIGTERM are taken by the shutdown thread below (sigwait), not by
+    // Crow; blocked before any thread starts so every thread inherits the mask
+    sigset_t shutdownSignals;
+    sigemptyset(&shutdownSignals);
+    sigaddset(&shutdownSignals, SIGINT);
+    sigaddset(&shutdownSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &shutdownSignals, nullptr);
+
     std::string dbPath = "db/users.db";
     if (const char* envDb = std::getenv("DB_PATH")) {
         dbPath = envDb;
     }
 
-    sqlite3* db = Database::init(dbPath.c_str());
-    if (!db) {
+    std::string backupDir = "db/backups";
+    if (const char* envBackupDir = std::getenv("BACKUP_DIR")) {
+        backupDir = envBackupDir;
+    }
+
+    // SHARD_COUNT>1 splits users/accounts over several files next to DB_PATH
+    int shardCount = static_cast<int>(env_long("SHARD_COUNT", 1));
+    if (shardCount < 1) {
+        std::cerr << "SHARD_COUNT must be at least 1\n";
+        return 1;
+    }
+    std::vector<std::string> dbFiles = ShardSet::file_paths(dbPath, shardCount);
+
+    // RESTORE_FROM=latest (newest complete backup set in BACKUP_DIR), a set id, or
+    // with one database file a snapshot file. Files are only ever restored together
+    // from one set. Only used while none of the database files exist, so leaving it
+    // set in the environment does not roll the data back on every restart.
+    std::vector<std::string> restoreFrom(dbFiles.size());
+    const char* envRestore = std::getenv("RESTORE_FROM");
+    std::string existingFile;
+    for (const std::string& file : dbFiles) {
+        if (envRestore && existingFile.empty() && std::filesystem::exists(file)) {
+            existingFile = file;
+        }
+    }
+    if (envRestore && !existingFile.empty()) {
+        std::cout << "RESTORE_FROM ignored: " << existingFile
+                  << " already exists (remove the database files to restore)" << std::endl;
+    } else if (envRestore) {
+        std::string restore = envRestore;
+        std::string err;
+        if (restore == "latest") {
+            // Nothing to restore yet (e.g. a first deployment) starts empty, as before
+            restoreFrom = BackupManager::latest_set(backupDir, dbFiles, err);
+            if (restoreFrom.empty()) {
+                std::cerr << "RESTORE_FROM=latest: " << err << "; starting without a restore\n";
+                restoreFrom.resize(dbFiles.size());
+            }
+        } else if (dbFiles.size() == 1 && std::filesystem::is_regular_file(restore)) {
+            restoreFrom[0] = restore;
+        } else {
+            restoreFrom = BackupManager::find_set(backupDir, dbFiles, restore, err);
+            if (restoreFrom.empty()) {
+                std::cerr << "RESTORE_FROM=" << restore << ": " << err << "\n";
+                return 1;
+            }
+        }
+    }
+
+    std::unique_ptr<ShardSet> shardSet = ShardSet::open(dbPath, shardCount, restoreFrom);
+    if (!shardSet) {
+        return 1;
+    }
+    ShardSet& shards = *shardSet;
+
+    // Which user / account ids exist, so existence checks and 404s skip SQLite
+    ExistenceIndex existence;
+    for (size_t i = 0; i < shards.size(); ++i) {
+        if (!existence.load(shards.shard(i))) {
+            return 1;
+        }
+    }
+    std::cout << "Existence index: " << existence.user_count() << " users, "
+              << existence.account_count() << " accounts" << std::endl;
+
+    std::string adminToken;
+    if (const char* envToken = std::getenv("ADMIN_TOKEN")) {
+        adminToken = envToken;
+    }
+    if (adminToken.empty()) {
+        std::cout << "ADMIN_TOKEN is not set: admin and debug routes are disabled" << std::endl;
+    }
+
+    size_t changeFeedCapacity = static_cast<size_t>(env_long("CHANGE_FEED_CAPACITY", 4096));
+
+    // Upper bound for ?ids= on multi-get routes. Capped so one request cannot make a
+    // huge JSON id list and a response with thousands of rows (plus their accounts).
+    long maxIdsSetting = env_long("MULTI_GET_MAX_IDS", 100);
+    if (maxIdsSetting < 1 || maxIdsSetting > kMaxMultiGetIdsLimit) {
+        std::cerr << "MULTI_GET_MAX_IDS must be between 1 and " << kMaxMultiGetIdsLimit << "\n";
         return 1;
     }
+    size_t maxMultiGetIds = static_cast<size_t>(maxIdsSetting);
+
+    // Online backups of every database file as one set; BACKUP_INTERVAL_MINUTES=0 means on demand only
+    auto backups = std::make_unique<BackupManager>(shards.connections(), dbFiles, backupDir,
+                                                   static_cast<int>(env_long("BACKUP_KEEP", 7)),
+                                                   std::chrono::minutes(env_long("BACKUP_INTERVAL_MINUTES", 0)));
+
+    // Recent mutations for GET /changes; must outlive the app
+    ChangeFeed changes(changeFeedCapacity);
+
+    // Every TRACE_SAMPLE_EVERY-th request is traced (0 = off); requests slower
+    // than SLOW_REQUEST_MS log their SQL with query plans (0 = off)
+    Tracer tracer(static_cast<unsigned>(env_long("TRACE_SAMPLE_EVERY", 100)),
+                  static_cast<size_t>(env_long("TRACE_KEEP", 50)),
+                  env_long("SLOW_REQUEST_MS", 500));
+    for (sqlite3* conn : shards.connections()) {
+        tracer.instrument(conn);
+    }
 
-    crow::App<RequestLogger> app;
+    // Set by the warm-up thread; GET /ready answers 503 until then
+    std::atomic<bool> ready{false};
+    WarmupStats warmupStats;
+
+    App app;
+    app.get_middleware<RequestLogger>().tracer = &tracer;
+
+    // SQLite work runs here, not on Crow's I/O threads. One reader and one writer thread
+    // per shard by default: all of them share the shard's connection, which SQLite
+    // serializes, so more threads would only wait on it. Write jobs also hold their
+    // shard's write lock (ShardSet::write_mutex), so each shard has one writer at a time.
+    // Its queued jobs complete responses, so it is drained (by the shutdown thread)
+    // while the app is still running.
+    DbExecutor executor(static_cast<size_t>(env_long("DB_READ_THREADS", static_cast<long>(shards.size()))),
+                        static_cast<size_t>(env_long("DB_WRITE_THREADS", static_cast<long>(shards.size()))),
+                        static_cast<size_t>(env_long("DB_QUEUE_LIMIT", 1024)));
+
+    // SELECT 1 on every database through the read queue every READY_PROBE_MS; /ready
+    // fails once the latest probe failed or is older than READY_MAX_AGE_MS
+    HealthProbe healthProbe(shards.connections(),
+                            [&executor](std::function<void()> job) {
+                                return executor.submit(DbExecutor::Kind::Read, std::move(job));
+                            },
+                            std::chrono::milliseconds(env_long("READY_PROBE_MS", 1000)));
+    std::chrono::milliseconds readyMaxAge(env_long("READY_MAX_AGE_MS", 5000));
+
+    // ANALYZE / incremental vacuum once the server has been quiet
+    // for MAINTENANCE_IDLE_MS; MAINTENANCE_INTERVAL_MINUTES=0 means on demand only
+    MaintenanceScheduler::Options maintenanceOptions;
+    maintenanceOptions.interval = std::chrono::minutes(env_long("MAINTENANCE_INTERVAL_MINUTES", 60));
+    maintenanceOptions.vacuumPages = static_cast<int>(env_long("MAINTENANCE_VACUUM_PAGES", 256));
+    maintenanceOptions.idleWindow = std::chrono::milliseconds(env_long("MAINTENANCE_IDLE_MS", 2000));
+    maintenanceOptions.idleRequests = static_cast<int>(env_long("MAINTENANCE_IDLE_REQUESTS", 0));
+    maintenanceOptions.convertAutoVacuum = env_long("MAINTENANCE_CONVERT_AUTO_VACUUM", 0) != 0;
+    // Load is database jobs, not open requests: parked /changes, SSE streams and
+    // profiles hold a request open without touching SQLite
+    MaintenanceScheduler maintenance(shards.connections(), dbFiles, maintenanceOptions, [&executor] {
+        return static_cast<int>(executor.pending());
+    });
 
         // ---- UI (served from the same origin: http://127.0.0.1:8080) ----
     CROW_ROUTE(app, "/")([] {
@@ -189,733 +887,1774 @@ int main() {
     ([](const crow::request&, crow::response& res, std::string) {
         res.set_header("Access-Control-Allow-Origin", "*");
         res.set_header("Access-Control-Allow-Methods", "GET, POST, PUT, PATCH, DELETE, OPTIONS");
-        res.set_header("Access-Control-Allow-Headers", "Content-Type");
+        res.set_header("Access-Control-Allow-Headers", "Content-Type, If-None-Match");
         res.code = 204;
         res.end();
     });
 
 
-    // Health check
+    // Health check (liveness: the process is serving HTTP)
     CROW_ROUTE(app, "/health")([] {
         return crow::response(200, "OK");
     });
 
-    // GET /users -> server-side sorted + paginated user listing
-    CROW_ROUTE(app, "/users").methods(crow::HTTPMethod::GET)
-    ([db](const crow::request& req) {
-
-        // ---- Sorting defaults ----
-        std::string sort = "lastName";
-        std::string order = "asc";
-
-        if (req.url_params.get("sort")) {
-            sort = req.url_params.get("sort");
-        }
-        if (req.url_params.get("order")) {
-            order = req.url_params.get("order");
-        }
-
-        if (order != "asc" && order != "desc") {
-            return json_error(400, "Invalid order (allowed: asc, desc)");
-        }
-
-        if (sort != "firstName" && sort != "lastName" &&
-            sort != "email" && sort != "createdAt") {
-            return json_error(400, "Invalid sort field");
+    // GET /ready -> 200 once the startup warm-up is done, the DB queues have room and
+    // the latest background SELECT 1 on every database succeeded recently (HealthProbe).
+    // Answered on the I/O thread from that recorded outcome, so a readiness probe
+    // never waits behind a long query itself.
+    CROW_ROUTE(app, "/ready")([&ready, &warmupStats, &executor, &healthProbe, readyMaxAge] {
+        crow::json::wvalue out;
+        int code = 200;
+
+        std::string dbProblem;
+        if (!ready.load(std::memory_order_acquire)) {
+            out["status"] = "warming";
+            code = 503;
+        } else {
+            out["status"] = "ready";
+            if (!executor.accepting(DbExecutor::Kind::Read) || !executor.accepting(DbExecutor::Kind::Write)) {
+                out["status"] = "overloaded";
+                code = 503;
+            } else if (!healthProbe.check(readyMaxAge, dbProblem)) {
+                out["status"] = "database unavailable";
+                out["error"] = dbProblem;
+                code = 503;
+            }
+            out["warmupMs"] = warmupStats.durationMs;
+            out["warmupBtrees"] = warmupStats.btrees;
+            out["warmupFileBytes"] = warmupStats.fileBytes;
         }
 
-        // ---- Pagination defaults ----
-        int page = 1;
-        int limit = 10;
+        crow::response res(code);
+        res.set_header("Content-Type", "application/json");
+        res.set_header("Cache-Control", "no-store");
+        write_json(res, out);
+        return res;
+    });
 
-        if (req.url_params.get("page")) {
-            page = std::stoi(req.url_params.get("page"));
-        }
-        if (req.url_params.get("limit")) {
-            limit = std::stoi(req.url_params.get("limit"));
+    // POST /admin/backup -> start an online backup set of every database file in the background
+    CROW_ROUTE(app, "/admin/backup").methods(crow::HTTPMethod::POST)
+    ([&backups, &dbFiles, adminToken](const crow::request& req) {
+        if (!admin_authorized(req, adminToken)) {
+            return admin_denied(adminToken);
         }
 
-        if (page < 1) {
-            return json_error(400, "page must be >= 1");
+        if (!backups->trigger()) {
+            return json_error(409, "A backup is already in progress");
         }
 
-        if (limit < 1 || limit > 100) {
-            return json_error(400, "limit must be between 1 and 100");
-        }
+        crow::json::wvalue out;
+        out["status"] = "started";
+        out["databases"] = static_cast<int>(dbFiles.size());
 
-        // ---- Fetch users (unsorted) ----
-        const char* sql =
-            "SELECT id, firstName, lastName, email, createdAt, updatedAt FROM users;";
+        crow::response res(202);
+        res.set_header("Content-Type", "application/json");
+        write_json(res, out);
+        return res;
+    });
 
-        sqlite3_stmt* stmt = nullptr;
-        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-            return json_error(500, "Failed to prepare query");
+    // GET /admin/backup -> state of the current / last backup set
+    CROW_ROUTE(app, "/admin/backup").methods(crow::HTTPMethod::GET)
+    ([&backups, adminToken](const crow::request& req) {
+        if (!admin_authorized(req, adminToken)) {
+            return admin_denied(adminToken);
         }
 
-        struct UserRow {
-            int id;
-            std::string firstName;
-            std::string lastName;
-            std::string email;
-            std::string createdAt;
-            std::string updatedAt;
-        };
+        BackupStatus st = backups->status();
+        crow::json::wvalue out;
+        out["running"] = st.running;
+        out["completed"] = st.completed;
+        out["lastSet"] = st.lastSet;
+        out["lastFiles"] = crow::json::wvalue::list();
+        for (size_t i = 0; i < st.lastFiles.size(); ++i) {
+            out["lastFiles"][i] = st.lastFiles[i];
+        }
+        out["lastError"] = st.lastError;
+        out["lastFinishedAt"] = st.lastFinishedAt;
+        out["lastDurationMs"] = st.lastDurationMs;
+        out["lastPages"] = st.lastPages;
 
-        std::vector<UserRow> users;
+        crow::response res(200);
+        res.set_header("Content-Type", "application/json");
+        write_json(res, out);
+        return res;
+    });
 
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-            users.push_back({
-                sqlite3_column_int(stmt, 0),
-                reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)),
-                reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2)),
-                reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3)),
-                reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4)),
-                reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5))
-            });
+    // POST /admin/maintenance -> run maintenance at the next quiet window, without waiting for the interval
+    CROW_ROUTE(app, "/admin/maintenance").methods(crow::HTTPMethod::POST)
+    ([&maintenance, adminToken](const crow::request& req) {
+        if (!admin_authorized(req, adminToken)) {
+            return admin_denied(adminToken);
         }
 
-        sqlite3_finalize(stmt);
-
-        // ---- Server-side sorting ----
-        auto cmp = [&](const UserRow& a, const UserRow& b) {
-            if (sort == "firstName") return a.firstName < b.firstName;
-            if (sort == "email")     return a.email < b.email;
-            if (sort == "createdAt") return a.createdAt < b.createdAt;
-            return a.lastName < b.lastName;
-        };
+        maintenance.trigger();
 
-        std::sort(users.begin(), users.end(),
-            [&](const UserRow& a, const UserRow& b) {
-                return (order == "asc") ? cmp(a, b) : cmp(b, a);
-            });
+        crow::json::wvalue out;
+        out["status"] = "scheduled";
 
-        // ---- Pagination ----
-        int start = (page - 1) * limit;
-        int end = std::min(start + limit, (int)users.size());
+        crow::response res(202);
+        res.set_header("Content-Type", "application/json");
+        write_json(res, out);
+        return res;
+    });
 
-        std::vector<UserRow> pagedUsers;
-        if (start < (int)users.size()) {
-            pagedUsers.assign(users.begin() + start, users.begin() + end);
+    // GET /admin/maintenance -> last maintenance run per database file
+    CROW_ROUTE(app, "/admin/maintenance").methods(crow::HTTPMethod::GET)
+    ([&maintenance, adminToken](const crow::request& req) {
+        if (!admin_authorized(req, adminToken)) {
+            return admin_denied(adminToken);
+        }
+
+        std::vector<crow::json::wvalue> databases;
+        for (const MaintenanceStats& st : maintenance.stats()) {
+            crow::json::wvalue entry;
+            entry["database"] = st.database;
+            entry["autoVacuum"] = st.autoVacuum;
+            entry["runs"] = st.runs;
+            entry["running"] = st.running;
+            entry["deferred"] = st.deferred;
+            entry["lastRunAt"] = st.lastRunAt;
+            entry["lastDurationMs"] = st.lastDurationMs;
+            entry["analyzed"] = st.analyzed;
+            entry["pagesVacuumed"] = st.pagesVacuumed;
+            entry["freelistPages"] = st.freelistPages;
+            entry["lastError"] = st.lastError;
+            databases.push_back(std::move(entry));
         }
 
-        // ---- Build response ----
-        crow::json::wvalue result;
-        result["page"] = page;
-        result["limit"] = limit;
-        result["total"] = (int)users.size();
-        result["users"] = crow::json::wvalue::list();
-
-        int i = 0;
-        for (const auto& u : pagedUsers) {
-            crow::json::wvalue j;
-            j["id"] = u.id;
-            j["firstName"] = u.firstName;
-            j["lastName"] = u.lastName;
-            j["email"] = u.email;
-            j["createdAt"] = u.createdAt;
-            j["updatedAt"] = u.updatedAt;
-            result["users"][i++] = std::move(j);
-        }
+        crow::json::wvalue out;
+        out["databases"] = std::move(databases);
 
         crow::response res(200);
         res.set_header("Content-Type", "application/json");
-        res.write(result.dump());
+        write_json(res, out);
         return res;
     });
 
+    // GET /debug/traces?limit=N -> newest sampled requests as Chrome trace-event JSON
+    // (load in chrome://tracing or https://ui.perfetto.dev)
+    CROW_ROUTE(app, "/debug/traces").methods(crow::HTTPMethod::GET)
+    ([&tracer, adminToken](const crow::request& req) {
+        if (!admin_authorized(req, adminToken)) {
+            return admin_denied(adminToken);
+        }
 
+        int limit = 20;
+        if (req.url_params.get("limit")) {
+            limit = std::atoi(req.url_params.get("limit"));
+        }
+        if (limit < 1 || limit > 1000) {
+            return json_error(400, "limit must be between 1 and 1000");
+        }
+
+        std::vector<crow::json::wvalue> events;
+        auto event = [&](const std::string& name, const char* cat, unsigned tid,
+                         std::uint64_t ts, std::uint64_t dur) -> crow::json::wvalue& {
+            crow::json::wvalue e;
+            e["name"] = name;
+            e["cat"] = cat;
+            e["ph"] = "X";
+            e["pid"] = 1;
+            e["tid"] = tid;
+            e["ts"] = ts;
+            e["dur"] = dur;
+            events.push_back(std::move(e));
+            return events.back();
+        };
 
-    // POST /users -> create a user (password stored as passwordHash for now)
-    CROW_ROUTE(app, "/users").methods(crow::HTTPMethod::POST)([db](const crow::request& req) {
-        auto body = crow::json::load(req.body);
-        if (!body) {
-            return json_error(400, "Invalid JSON");
+        for (const RequestTrace& t : tracer.recent(static_cast<size_t>(limit))) {
+            event(t.name, "request", t.thread, t.startUs, t.durUs)["args"]["status"] = t.status;
+            for (const TraceSpan& span : t.spans) {
+                event(span.name, "phase", t.thread, span.startUs, span.durUs);
+            }
+            for (const TracedQuery& q : t.queries) {
+                event("sql", "sql", t.thread, q.startUs, q.durUs)["args"]["sql"] = std::string(t.sql(q));
+            }
         }
 
-        if (!body.has("firstName") || !body.has("lastName") || !body.has("email") || !body.has("password")) {
-            return json_error(400, "Missing required fields: firstName, lastName, email, password");
-        }
+        crow::json::wvalue out;
+        out["traceEvents"] = std::move(events);
+        out["displayTimeUnit"] = "ms";
 
-        std::string firstName = trim(body["firstName"].s());
-        std::string lastName  = trim(body["lastName"].s());
-        std::string email     = trim(body["email"].s());
-        std::string password  = body["password"].s(); // don’t trim passwords
+        crow::response res(200);
+        res.set_header("Content-Type", "application/json");
+        write_json(res, out);
+        return res;
+    });
 
-        // Empty checks after trimming
-        if (firstName.empty() || lastName.empty() || email.empty() || password.empty()) {
-            return json_error(400, "Fields cannot be empty");
+#ifdef COUNT_HEAP_ALLOCATIONS
+    // GET /debug/allocations -> global operator new calls so far (PROFILE=alloc-count builds);
+    // a benchmark reads it before and after a run to get allocations per request
+    CROW_ROUTE(app, "/debug/allocations").methods(crow::HTTPMethod::GET)
+    ([adminToken](const crow::request& req) {
+        if (!admin_authorized(req, adminToken)) {
+            return admin_denied(adminToken);
         }
 
-        // Length limits
-        if (firstName.length() > 100 || lastName.length() > 100) {
-            return json_error(400, "First and last name must be at most 100 characters");
+        crow::json::wvalue out;
+        out["heapAllocations"] = static_cast<std::uint64_t>(heap_allocations());
+
+        crow::response res(200);
+        res.set_header("Content-Type", "application/json");
+        write_json(res, out);
+        return res;
+    });
+#endif
+
+    // GET /debug/executor -> depth and wait time of the database read / write queues
+    CROW_ROUTE(app, "/debug/executor").methods(crow::HTTPMethod::GET)
+    ([&executor, adminToken](const crow::request& req) {
+        if (!admin_authorized(req, adminToken)) {
+            return admin_denied(adminToken);
+        }
+
+        crow::json::wvalue out;
+        for (DbExecutor::Kind kind : {DbExecutor::Kind::Read, DbExecutor::Kind::Write}) {
+            QueueStats st = executor.stats(kind);
+            crow::json::wvalue& q = out[st.name];
+            q["threads"] = st.threads;
+            q["depth"] = st.depth;
+            q["peakDepth"] = st.peakDepth;
+            q["running"] = st.running;
+            q["completed"] = st.completed;
+            q["rejected"] = st.rejected;
+            q["avgWaitMs"] = st.avgWaitMs;
+        }
+
+        crow::response res(200);
+        res.set_header("Content-Type", "application/json");
+        write_json(res, out);
+        return res;
+    });
+
+    // GET /debug/profile?seconds=N&hz=M -> CPU profile as collapsed stacks (for flamegraphs).
+    // Opt-in with PROFILER=1; runs on its own thread so no I/O thread waits out the profile.
+    // One profile at a time; shutdown cancels and joins it before the app stops.
+    bool profilerEnabled = env_long("PROFILER", 0) != 0;
+    std::mutex profileMutex;
+    std::thread profileThread;      // guarded by profileMutex
+    bool profileRunning = false;    // guarded by profileMutex
+    bool profilesClosed = false;    // guarded by profileMutex; set at shutdown
+    CROW_ROUTE(app, "/debug/profile").methods(crow::HTTPMethod::GET)
+    ([profilerEnabled, adminToken, &profileMutex, &profileThread, &profileRunning, &profilesClosed]
+     (const crow::request& req, crow::response& res) {
+        Tracer::skip_slow_log();
+
+        if (!profilerEnabled) {
+            res = json_error(404, "Profiler disabled (set PROFILER=1)");
+            res.end();
+            return;
+        }
+        if (!admin_authorized(req, adminToken)) {
+            res = admin_denied(adminToken);
+            res.end();
+            return;
+        }
+
+        int seconds = req.url_params.get("seconds") ? std::atoi(req.url_params.get("seconds")) : 10;
+        int hz = req.url_params.get("hz") ? std::atoi(req.url_params.get("hz")) : 99;
+        if (seconds < 1 || seconds > 60) {
+            res = json_error(400, "seconds must be between 1 and 60");
+            res.end();
+            return;
+        }
+        if (hz < 1 || hz > 1000) {
+            res = json_error(400, "hz must be between 1 and 1000");
+            res.end();
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(profileMutex);
+        if (profilesClosed) {
+            res = json_error(503, "Shutting down");
+            res.end();
+            return;
+        }
+        if (profileRunning) {
+            res = json_error(409, "A profile is already running");
+            res.end();
+            return;
+        }
+        if (profileThread.joinable()) {
+            profileThread.join();   // previous profile, already finished
+        }
+
+        profileRunning = true;
+        profileThread = std::thread([&res, seconds, hz, &profileMutex, &profileRunning] {
+            std::string collapsed;
+            std::string err;
+            switch (Profiler::collect(seconds, hz, collapsed, err)) {
+                case Profiler::Outcome::Ok:
+                    res.code = 200;
+                    res.set_header("Content-Type", "text/plain; charset=utf-8");
+                    res.write(collapsed);
+                    break;
+                case Profiler::Outcome::Busy:
+                    res = json_error(409, err);
+                    break;
+                case Profiler::Outcome::ShuttingDown:
+                    res = json_error(503, err);
+                    break;
+                case Profiler::Outcome::Failed:
+                    res = json_error(500, err);
+                    break;
+            }
+            res.end();
+
+            std::lock_guard<std::mutex> lock(profileMutex);
+            profileRunning = false;
+        });
+    });
+
+    // GET /changes?since=<cursor> -> mutation feed as SSE (Accept: text/event-stream)
+    // or JSON long-poll. Idle subscribers are parked without holding a thread.
+    CROW_ROUTE(app, "/changes").methods(crow::HTTPMethod::GET)
+    ([&changes](const crow::request& req, crow::response& res) {
+        // Parked for up to `timeout` seconds by design; not a slow request
+        Tracer::skip_slow_log();
+
+        bool sse = req.get_header_value("Accept").find("text/event-stream") != std::string::npos;
+
+        // EventSource reconnects send the last seen id instead of ?since
+        std::uint64_t since = changes.head();
+        bool current = true;
+        std::string cursor;
+        if (req.url_params.get("since")) {
+            cursor = req.url_params.get("since");
+        } else {
+            cursor = req.get_header_value("Last-Event-ID");
+        }
+        if (!cursor.empty() && !changes.parse_cursor(cursor, since, current)) {
+            res = json_error(400, "since must be a cursor from a previous /changes response");
+            res.end();
+            return;
         }
 
-        if (email.length() > 255) {
-            return json_error(400, "Email must be at most 255 characters");
+        int timeoutSec = 25;
+        int limit = 100;
+        try {
+            if (req.url_params.get("timeout")) {
+                timeoutSec = std::stoi(req.url_params.get("timeout"));
+            }
+            if (req.url_params.get("limit")) {
+                limit = std::stoi(req.url_params.get("limit"));
+            }
+        } catch (...) {
+            res = json_error(400, "timeout and limit must be non-negative integers");
+            res.end();
+            return;
         }
 
-        if (password.length() < 6) {
-            return json_error(400, "Password must be at least 6 characters");
+        if (timeoutSec < 0 || timeoutSec > 60) {
+            res = json_error(400, "timeout must be between 0 and 60");
+            res.end();
+            return;
+        }
+        if (limit < 1 || limit > 1000) {
+            res = json_error(400, "limit must be between 1 and 1000");
+            res.end();
+            return;
         }
 
-        // Email format check
-        if (!is_valid_email(email)) {
-            return json_error(400, "Invalid email format");
+        // A cursor from an earlier run resyncs at once
+        if (timeoutSec == 0 || !current) {
+            finish_changes(changes, res, since, current, limit, sse);
+            return;
         }
 
+        changes.wait(since, std::chrono::seconds(timeoutSec),
+            [&changes, &res, since, limit, sse] {
+                finish_changes(changes, res, since, true, limit, sse);
+            });
+    });
 
-        // NOTE: Replace with real hashing later 
-        std::string passwordHash = password;
+    // GET /users -> server-side sorted + paginated user listing
+    CROW_ROUTE(app, "/users").methods(crow::HTTPMethod::GET)
+    ([&shards, &existence, maxMultiGetIds, &app, &executor](const crow::request& req, crow::response& res) {
+        run_db(executor, DbExecutor::Kind::Read, res, [&] {
+            std::pmr::memory_resource* mem = request_memory(app, req);
 
-        const char* sql =
-            "INSERT INTO users (firstName, lastName, email, passwordHash) "
-            "VALUES (?, ?, ?, ?);";
+            // ---- Sorting defaults ----
+            std::string sort = "lastName";
+            std::string order = "asc";
 
-        sqlite3_stmt* stmt = nullptr;
-        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-            return json_error(500, "Failed to prepare insert");
-        }
+            if (req.url_params.get("sort")) {
+                sort = req.url_params.get("sort");
+            }
+            if (req.url_params.get("order")) {
+                order = req.url_params.get("order");
+            }
 
-        sqlite3_bind_text(stmt, 1, firstName.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_text(stmt, 2, lastName.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_text(stmt, 3, email.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_text(stmt, 4, passwordHash.c_str(), -1, SQLITE_TRANSIENT);
+            if (order != "asc" && order != "desc") {
+                return json_error(400, "Invalid order (allowed: asc, desc)");
+            }
 
-        int rc = sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
+            if (sort != "firstName" && sort != "lastName" &&
+                sort != "email" && sort != "createdAt") {
+                return json_error(400, "Invalid sort field");
+            }
 
-        if (rc != SQLITE_DONE) {
-            if (rc == SQLITE_CONSTRAINT) {
-                return json_error(409, "Email already exists");
+            // ---- Pagination defaults ----
+            int page = 1;
+            int limit = 10;
+
+            if (req.url_params.get("page")) {
+                page = std::stoi(req.url_params.get("page"));
+            }
+            if (req.url_params.get("limit")) {
+                limit = std::stoi(req.url_params.get("limit"));
             }
-            return json_error(500, "Failed to create user");
-        }
 
-        int newId = static_cast<int>(sqlite3_last_insert_rowid(db));
+            if (page < 1) {
+                return json_error(400, "page must be >= 1");
+            }
 
-        crow::json::wvalue out;
-        out["id"] = newId;
-        out["firstName"] = firstName;
-        out["lastName"] = lastName;
-        out["email"] = email;
+            if (limit < 1 || limit > 100) {
+                return json_error(400, "limit must be between 1 and 100");
+            }
 
-        crow::response res(201);
-        res.set_header("Content-Type", "application/json");
-        res.write(out.dump());
-        return res;
+            // ---- Projection / embedding ----
+            std::vector<std::string> fields;
+            std::string unknownField;
+            if (!parse_fields(req.url_params.get("fields"), kUserFields, fields, unknownField)) {
+                return json_error(400, "Unknown field in fields: " + unknownField);
+            }
+
+            bool includeAccounts = false;
+            if (!parse_include_accounts(req.url_params.get("include"), includeAccounts)) {
+                return json_error(400, "Invalid include (allowed: accounts)");
+            }
+
+            // ---- Conditional GET (read the version before the rows) ----
+            long long usersVersion = entity_version(shards, "users");
+            long long accountsVersion = includeAccounts ? entity_version(shards, "accounts") : 0;
+            if (usersVersion < 0 || accountsVersion < 0) {
+                return json_error(500, "Failed to read users version");
+            }
+
+            std::string etag = includeAccounts
+                ? ETag::make("users-a" + std::to_string(accountsVersion), usersVersion)
+                : ETag::make("users", usersVersion);
+            if (etag_matches(req, etag)) {
+                return not_modified(etag);
+            }
+
+            // ---- Multi-get: ?ids=1,2,3 -> one query, results in request order ----
+            if (req.url_params.get("ids")) {
+                std::vector<int> ids;
+                std::string err;
+                if (!parse_id_list(req.url_params.get("ids"), maxMultiGetIds, ids, err)) {
+                    return json_error(400, err);
+                }
+
+                UserProjection projection;
+                projection.add("id");
+                for (const auto& f : fields) {
+                    projection.add(f);
+                }
+
+                std::string sql = "SELECT " + projection.select_list() +
+                                  " FROM users WHERE id IN (SELECT value FROM json_each(?));";
+
+                // One query per shard that owns any of the ids; unknown ids never reach SQLite
+                std::vector<std::vector<int>> idsByShard(shards.size());
+                for (int id : ids) {
+                    if (existence.has_user(id)) {
+                        idsByShard[shards.shard_of_user(id)].push_back(id);
+                    }
+                }
+
+                std::map<int, UserRow> found;
+                for (size_t s = 0; s < shards.size(); ++s) {
+                    if (idsByShard[s].empty()) continue;
+
+                    sqlite3_stmt* stmt = nullptr;
+                    if (sqlite3_prepare_v2(shards.shard(s), sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+                        return json_error(500, "Failed to prepare query");
+                    }
+
+                    std::string idsJson = ids_to_json_array(idsByShard[s]);
+                    sqlite3_bind_text(stmt, 1, idsJson.c_str(), -1, SQLITE_TRANSIENT);
+
+                    while (sqlite3_step(stmt) == SQLITE_ROW) {
+                        UserRow row;
+                        projection.read(stmt, row);
+                        found[row.id] = std::move(row);
+                    }
+                    sqlite3_finalize(stmt);
+                }
+
+                std::map<int, std::vector<crow::json::wvalue>> accountsByUser;
+                if (includeAccounts) {
+                    std::vector<int> foundIds;
+                    for (const auto& kv : found) {
+                        foundIds.push_back(kv.first);
+                    }
+                    if (!load_accounts_for_users(shards, foundIds, accountsByUser)) {
+                        return json_error(500, "Failed to load accounts");
+                    }
+                }
+
+                crow::json::wvalue result;
+                result["users"] = crow::json::wvalue::list();
+
+                int i = 0;
+                for (int id : ids) {
+                    auto it = found.find(id);
+                    if (it == found.end()) {
+                        result["users"][i++] = not_found_marker(id, "User not found");
+                        continue;
+                    }
+
+                    crow::json::wvalue j;
+                    write_user_fields(it->second, fields, j);
+                    if (includeAccounts) {
+                        // Copy rather than move: an id may be requested twice
+                        j["accounts"] = crow::json::wvalue::list();
+                        int k = 0;
+                        for (const auto& a : accountsByUser[id]) {
+                            j["accounts"][k++] = crow::json::wvalue(a);
+                        }
+                    }
+                    result["users"][i++] = std::move(j);
+                }
+
+                crow::response res(200);
+                res.set_header("Content-Type", "application/json");
+                set_etag(res, etag);
+                write_json(res, result);
+                return res;
+            }
+
+            // ---- Fetch users, reading only the columns needed ----
+            UserProjection projection;
+            projection.add("id");
+            projection.add(sort);
+            for (const auto& f : fields) {
+                projection.add(f);
+            }
+
+            // Each shard sorts (id breaks ties) and returns only the rows that can
+            // land on this page or before it; SQLite keeps just those while sorting.
+            // `sort` and `order` were checked against fixed lists above.
+            const std::string direction = (order == "asc") ? " ASC" : " DESC";
+            std::string sql = "SELECT " + projection.select_list() + " FROM users ORDER BY " +
+                              sort + direction + ", id" + direction + " LIMIT ?;";
+            long long needed = static_cast<long long>(page) * limit;
+
+            // ---- Merge order: the same as the per-shard ORDER BY ----
+            auto cmp = [&](const UserRow& a, const UserRow& b) {
+                const std::pmr::string* x = &a.lastName;
+                const std::pmr::string* y = &b.lastName;
+                if (sort == "firstName")      { x = &a.firstName; y = &b.firstName; }
+                else if (sort == "email")     { x = &a.email;     y = &b.email; }
+                else if (sort == "createdAt") { x = &a.createdAt; y = &b.createdAt; }
+                if (*x != *y) return *x < *y;
+                return a.id < b.id;
+            };
+            auto ordered = [&](const UserRow& a, const UserRow& b) {
+                return (order == "asc") ? cmp(a, b) : cmp(b, a);
+            };
+
+            // Every row (and its strings) lives in the request arena
+            std::pmr::vector<UserRow> users(mem);
+            long long total = 0;
+
+            // Each shard's rows arrive sorted and are merged into the run before them
+            for (size_t s = 0; s < shards.size(); ++s) {
+                sqlite3_stmt* stmt = nullptr;
+                {
+                    ScopedSpan span("count");
+                    if (sqlite3_prepare_v2(shards.shard(s), "SELECT COUNT(*) FROM users;", -1, &stmt,
+                                           nullptr) != SQLITE_OK) {
+                        return json_error(500, "Failed to prepare query");
+                    }
+                    if (sqlite3_step(stmt) == SQLITE_ROW) {
+                        total += sqlite3_column_int64(stmt, 0);
+                    }
+                    sqlite3_finalize(stmt);
+                }
+
+                {
+                    ScopedSpan span("prepare");
+                    if (sqlite3_prepare_v2(shards.shard(s), sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+                        return json_error(500, "Failed to prepare query");
+                    }
+                }
+                sqlite3_bind_int64(stmt, 1, needed);
+
+                size_t segment = users.size();
+                {
+                    ScopedSpan span("fetch");
+                    while (sqlite3_step(stmt) == SQLITE_ROW) {
+                        users.emplace_back();
+                        projection.read(stmt, users.back());
+                    }
+
+                    sqlite3_finalize(stmt);
+                }
+
+                ScopedSpan span("merge");
+                std::inplace_merge(users.begin(), users.begin() + segment, users.end(), ordered);
+            }
+
+            // ---- Pagination (a view into the sorted rows, no copies) ----
+            size_t start = static_cast<size_t>(std::min<long long>(needed - limit, (long long)users.size()));
+            size_t end = std::min(start + static_cast<size_t>(limit), users.size());
+
+            auto pagedBegin = users.begin() + start;
+            auto pagedEnd = users.begin() + end;
+
+            // ---- Embedded accounts: one batched query for the whole page ----
+            std::map<int, std::vector<crow::json::wvalue>> accountsByUser;
+            if (includeAccounts) {
+                std::vector<int> ids;
+                ids.reserve(end - start);
+                for (auto it = pagedBegin; it != pagedEnd; ++it) {
+                    ids.push_back(it->id);
+                }
+                if (!load_accounts_for_users(shards, ids, accountsByUser)) {
+                    return json_error(500, "Failed to load accounts");
+                }
+            }
+
+            // ---- Build response ----
+            crow::json::wvalue result;
+            result["page"] = page;
+            result["limit"] = limit;
+            result["total"] = total;
+            result["users"] = crow::json::wvalue::list();
+
+            int i = 0;
+            for (auto it = pagedBegin; it != pagedEnd; ++it) {
+                const UserRow& u = *it;
+                crow::json::wvalue j;
+                write_user_fields(u, fields, j);
+
+                if (includeAccounts) {
+                    j["accounts"] = crow::json::wvalue::list();
+                    int k = 0;
+                    for (auto& a : accountsByUser[u.id]) {
+                        j["accounts"][k++] = std::move(a);
+                    }
+                }
+                result["users"][i++] = std::move(j);
+            }
+
+            crow::response res(200);
+            res.set_header("Content-Type", "application/json");
+            set_etag(res, etag);
+            write_json(res, result);
+            return res;
+        });
+    });
+
+
+
+    // POST /users -> create a user (password stored as passwordHash for now)
+    CROW_ROUTE(app, "/users").methods(crow::HTTPMethod::POST)([&shards, &existence, &changes, &executor](const crow::request& req, crow::response& res) {
+        run_db(executor, DbExecutor::Kind::Write, res, [&] {
+            auto body = parse_body(req);
+            if (!body) {
+                return json_error(400, "Invalid JSON");
+            }
+
+            if (!body.has("firstName") || !body.has("lastName") || !body.has("email") || !body.has("password")) {
+                return json_error(400, "Missing required fields: firstName, lastName, email, password");
+            }
+
+            // Views into the parsed body: no per-field string copies
+            std::string_view firstName = trim_view(json_text(body["firstName"]));
+            std::string_view lastName  = trim_view(json_text(body["lastName"]));
+            std::string_view email     = trim_view(json_text(body["email"]));
+            std::string_view password  = json_text(body["password"]); // don’t trim passwords
+
+            // Empty checks after trimming
+            if (firstName.empty() || lastName.empty() || email.empty() || password.empty()) {
+                return json_error(400, "Fields cannot be empty");
+            }
+
+            // Length limits
+            if (firstName.length() > 100 || lastName.length() > 100) {
+                return json_error(400, "First and last name must be at most 100 characters");
+            }
+
+            if (email.length() > 255) {
+                return json_error(400, "Email must be at most 255 characters");
+            }
+
+            if (password.length() < 6) {
+                return json_error(400, "Password must be at least 6 characters");
+            }
+
+            // Email format check
+            if (!is_valid_email(email)) {
+                return json_error(400, "Invalid email format");
+            }
+
+
+            // NOTE: Replace with real hashing later 
+            std::string_view passwordHash = password;
+
+            // Sharded: the router issues the id and owns email uniqueness
+            long long reservedId = 0;
+            if (shards.sharded()) {
+                int rc = shards.reserve_user(std::string(email), reservedId);
+                if (rc == SQLITE_CONSTRAINT) {
+                    return json_error(409, "Email already exists");
+                }
+                if (rc != SQLITE_OK) {
+                    return json_error(500, "Failed to create user");
+                }
+            }
+            sqlite3* db = shards.for_user(reservedId);
+            std::lock_guard<std::mutex> writer(shards.write_mutex(shards.shard_of_user(reservedId)));
+
+            // id is NULL (auto-assigned) unless the router reserved one
+            const char* sql =
+                "INSERT INTO users (id, firstName, lastName, email, passwordHash) "
+                "VALUES (?, ?, ?, ?, ?) RETURNING id;";
+
+            sqlite3_stmt* stmt = nullptr;
+            if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+                if (reservedId) shards.release_user(reservedId);
+                return json_error(500, "Failed to prepare insert");
+            }
+
+            if (reservedId) {
+                sqlite3_bind_int64(stmt, 1, reservedId);
+            } else {
+                sqlite3_bind_null(stmt, 1);
+            }
+            bind_text(stmt, 2, firstName);
+            bind_text(stmt, 3, lastName);
+            bind_text(stmt, 4, email);
+            bind_text(stmt, 5, passwordHash);
+
+            int rc = sqlite3_step(stmt);
+            int newId = (rc == SQLITE_ROW) ? sqlite3_column_int(stmt, 0) : 0;
+            sqlite3_finalize(stmt);
+
+            if (rc != SQLITE_ROW) {
+                if (reservedId) shards.release_user(reservedId);
+                if (rc == SQLITE_CONSTRAINT) {
+                    return json_error(409, "Email already exists");
+                }
+                return json_error(500, "Failed to create user");
+            }
+
+            existence.add_user(newId);
+            changes.publish(ChangeEntity::User, newId, ChangeOp::Create, 1);
+
+            crow::json::wvalue out;
+            out["id"] = newId;
+            out["firstName"] = std::string(firstName);
+            out["lastName"] = std::string(lastName);
+            out["email"] = std::string(email);
+
+            crow::response res(201);
+            res.set_header("Content-Type", "application/json");
+            write_json(res, out);
+            return res;
+        });
     });
 
     // POST /login -> authenticate user
     CROW_ROUTE(app, "/login").methods(crow::HTTPMethod::POST)
-    ([db](const crow::request& req) {
-        auto body = crow::json::load(req.body);
-        if (!body) {
-            return json_error(400, "Invalid JSON");
-        }
+    ([&shards, &executor](const crow::request& req, crow::response& res) {
+        run_db(executor, DbExecutor::Kind::Read, res, [&] {
+            auto body = parse_body(req);
+            if (!body) {
+                return json_error(400, "Invalid JSON");
+            }
 
-        if (!body.has("email") || !body.has("password")) {
-            return json_error(400, "Missing required fields: email, password");
-        }
+            if (!body.has("email") || !body.has("password")) {
+                return json_error(400, "Missing required fields: email, password");
+            }
 
-        std::string email = trim(body["email"].s());
-        std::string password = body["password"].s();
+            std::string email = trim(body["email"].s());
+            std::string password = body["password"].s();
 
-        if (email.empty() || password.empty()) {
-            return json_error(400, "Email and password cannot be empty");
-        }
+            if (email.empty() || password.empty()) {
+                return json_error(400, "Email and password cannot be empty");
+            }
 
-        const char* sql =
-            "SELECT id, passwordHash FROM users WHERE email = ?;";
+            // Sharded: the router says which shard holds this email
+            sqlite3* db = shards.shard(0);
+            if (shards.sharded()) {
+                long long routedId = shards.user_id_for_email(email);
+                if (routedId == 0) {
+                    return json_error(401, "Invalid email or password");
+                }
+                db = shards.for_user(routedId);
+            }
 
-        sqlite3_stmt* stmt = nullptr;
-        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-            return json_error(500, "Failed to prepare query");
-        }
+            const char* sql =
+                "SELECT id, passwordHash FROM users WHERE email = ?;";
 
-        sqlite3_bind_text(stmt, 1, email.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_stmt* stmt = nullptr;
+            if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+                return json_error(500, "Failed to prepare query");
+            }
 
-        int rc = sqlite3_step(stmt);
-        if (rc != SQLITE_ROW) {
-            sqlite3_finalize(stmt);
-            return json_error(401, "Invalid email or password");
-        }
+            sqlite3_bind_text(stmt, 1, email.c_str(), -1, SQLITE_TRANSIENT);
 
-        int userId = sqlite3_column_int(stmt, 0);
-        std::string storedHash =
-            reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+            int rc = sqlite3_step(stmt);
+            if (rc != SQLITE_ROW) {
+                sqlite3_finalize(stmt);
+                return json_error(401, "Invalid email or password");
+            }
 
-        sqlite3_finalize(stmt);
+            int userId = sqlite3_column_int(stmt, 0);
+            std::string storedHash =
+                reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
 
-        // NOTE: Plain-text comparison for now (documented limitation)
-        if (password != storedHash) {
-            return json_error(401, "Invalid email or password");
-        }
+            sqlite3_finalize(stmt);
 
-        crow::json::wvalue out;
-        out["message"] = "Authentication successful";
-        out["userId"] = userId;
+            // NOTE: Plain-text comparison for now (documented limitation)
+            if (password != storedHash) {
+                return json_error(401, "Invalid email or password");
+            }
 
-        crow::response res(200);
-        res.set_header("Content-Type", "application/json");
-        res.write(out.dump());
-        return res;
+            crow::json::wvalue out;
+            out["message"] = "Authentication successful";
+            out["userId"] = userId;
+
+            crow::response res(200);
+            res.set_header("Content-Type", "application/json");
+            write_json(res, out);
+            return res;
+        });
     });
 
 
 
     // GET /users/:id -> return a single user by ID
     CROW_ROUTE(app, "/users/<int>").methods(crow::HTTPMethod::GET)
-    ([db](int userId) {
-        const char* sql =
-            "SELECT id, firstName, lastName, email, createdAt, updatedAt "
-            "FROM users WHERE id = ?;";
+    ([&shards, &existence, &executor](const crow::request& req, crow::response& res, int userId) {
+        run_db(executor, DbExecutor::Kind::Read, res, [&, userId] {
+            if (!existence.has_user(userId)) {
+                return json_error(404, "User not found");
+            }
+            sqlite3* db = shards.for_user(userId);
 
-        sqlite3_stmt* stmt = nullptr;
-        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-            return json_error(500, "Failed to prepare query");
-        }
+            std::vector<std::string> fields;
+            std::string unknownField;
+            if (!parse_fields(req.url_params.get("fields"), kUserFields, fields, unknownField)) {
+                return json_error(400, "Unknown field in fields: " + unknownField);
+            }
+
+            bool includeAccounts = false;
+            if (!parse_include_accounts(req.url_params.get("include"), includeAccounts)) {
+                return json_error(400, "Invalid include (allowed: accounts)");
+            }
+
+            long long accountsVersion = includeAccounts ? entity_version(db, "accounts") : 0;
+            if (accountsVersion < 0) {
+                return json_error(500, "Failed to read accounts version");
+            }
+
+            // version is always read: the ETag is derived from it
+            UserProjection projection;
+            projection.add("version");
+            for (const auto& f : fields) {
+                projection.add(f);
+            }
 
-        sqlite3_bind_int(stmt, 1, userId);
+            std::string sql = "SELECT " + projection.select_list() + " FROM users WHERE id = ?;";
 
-        int rc = sqlite3_step(stmt);
-        if (rc != SQLITE_ROW) {
+            sqlite3_stmt* stmt = nullptr;
+            if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+                return json_error(500, "Failed to prepare query");
+            }
+
+            sqlite3_bind_int(stmt, 1, userId);
+
+            int rc = sqlite3_step(stmt);
+            if (rc != SQLITE_ROW) {
+                sqlite3_finalize(stmt);
+                return json_error(404, "User not found");
+            }
+
+            // Answer 304 straight from the version column, before serializing
+            long long version = sqlite3_column_int64(stmt, 0);
+            std::string tag = "user-" + std::to_string(userId);
+            if (includeAccounts) {
+                tag += "-a" + std::to_string(accountsVersion);
+            }
+            std::string etag = ETag::make(tag, version);
+            if (etag_matches(req, etag)) {
+                sqlite3_finalize(stmt);
+                return not_modified(etag);
+            }
+
+            UserRow row;
+            row.id = userId;
+            projection.read(stmt, row);
             sqlite3_finalize(stmt);
-            return json_error(404, "User not found");
-        }
 
-        crow::json::wvalue user;
-        user["id"] = sqlite3_column_int(stmt, 0);
-        user["firstName"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-        user["lastName"]  = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-        user["email"]     = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
-        user["createdAt"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4));
-        user["updatedAt"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5));
+            crow::json::wvalue user;
+            write_user_fields(row, fields, user);
 
-        sqlite3_finalize(stmt);
+            if (includeAccounts) {
+                std::map<int, std::vector<crow::json::wvalue>> accountsByUser;
+                if (!load_accounts_for_users(db, {userId}, accountsByUser)) {
+                    return json_error(500, "Failed to load accounts");
+                }
 
-        crow::response res(200);
-        res.set_header("Content-Type", "application/json");
-        res.write(user.dump());
-        return res;
+                user["accounts"] = crow::json::wvalue::list();
+                int k = 0;
+                for (auto& a : accountsByUser[userId]) {
+                    user["accounts"][k++] = std::move(a);
+                }
+            }
+
+            crow::response res(200);
+            res.set_header("Content-Type", "application/json");
+            set_etag(res, etag);
+            write_json(res, user);
+            return res;
+        });
     });
 
     // GET /users/:id/accounts -> list accounts for a user
     CROW_ROUTE(app, "/users/<int>/accounts").methods(crow::HTTPMethod::GET)
-    ([db](int userId) {
-        if (!user_exists(db, userId)) {
-            return json_error(404, "User not found");
-        }
+    ([&shards, &existence, &executor](const crow::request& req, crow::response& res, int userId) {
+        run_db(executor, DbExecutor::Kind::Read, res, [&, userId] {
+            sqlite3* db = shards.for_user(userId);
 
-        const char* sql =
-            "SELECT id, userId, type, status, balance, createdAt, updatedAt "
-            "FROM accounts WHERE userId = ? ORDER BY id ASC;";
+            if (!existence.has_user(userId)) {
+                return json_error(404, "User not found");
+            }
 
-        sqlite3_stmt* stmt = nullptr;
-        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-            return json_error(500, "Failed to prepare query");
-        }
+            long long accountsVersion = entity_version(db, "accounts");
+            if (accountsVersion < 0) {
+                return json_error(500, "Failed to read accounts version");
+            }
 
-        sqlite3_bind_int(stmt, 1, userId);
+            std::string etag = ETag::make("accounts-u" + std::to_string(userId), accountsVersion);
+            if (etag_matches(req, etag)) {
+                return not_modified(etag);
+            }
 
-        crow::json::wvalue result;
-        result["accounts"] = crow::json::wvalue::list();
+            std::string sql = std::string("SELECT ") + kAccountColumns +
+                              " FROM accounts WHERE userId = ? ORDER BY id ASC;";
 
-        int i = 0;
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-            crow::json::wvalue a;
+            sqlite3_stmt* stmt = nullptr;
+            if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+                return json_error(500, "Failed to prepare query");
+            }
 
-            a["id"] = sqlite3_column_int(stmt, 0);
-            a["userId"] = sqlite3_column_int(stmt, 1);
-            a["type"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-            a["status"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
-            a["balance"] = sqlite3_column_double(stmt, 4);
-            a["createdAt"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5));
-            a["updatedAt"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 6));
+            sqlite3_bind_int(stmt, 1, userId);
 
-            result["accounts"][i++] = std::move(a);
-        }
+            crow::json::wvalue result;
+            result["accounts"] = crow::json::wvalue::list();
 
-        sqlite3_finalize(stmt);
+            int i = 0;
+            while (sqlite3_step(stmt) == SQLITE_ROW) {
+                result["accounts"][i++] = account_json(stmt);
+            }
 
-        crow::response res(200);
-        res.set_header("Content-Type", "application/json");
-        res.write(result.dump());
-        return res;
+            sqlite3_finalize(stmt);
+
+            crow::response res(200);
+            res.set_header("Content-Type", "application/json");
+            set_etag(res, etag);
+            write_json(res, result);
+            return res;
+        });
     });
 
     // PUT /users/:id -> fully replace a user
     CROW_ROUTE(app, "/users/<int>").methods(crow::HTTPMethod::PUT)
-    ([db](const crow::request& req, int userId) {
-        if (!user_exists(db, userId)) {
-            return json_error(404, "User not found");
-        }
+    ([&shards, &existence, &changes, &executor](const crow::request& req, crow::response& res, int userId) {
+        run_db(executor, DbExecutor::Kind::Write, res, [&, userId] {
+            sqlite3* db = shards.for_user(userId);
+            if (!existence.has_user(userId)) {
+                return json_error(404, "User not found");
+            }
 
-        auto body = crow::json::load(req.body);
-        if (!body) {
-            return json_error(400, "Invalid JSON");
-        }
+            auto body = parse_body(req);
+            if (!body) {
+                return json_error(400, "Invalid JSON");
+            }
 
-        if (!body.has("firstName") || !body.has("lastName") || !body.has("email")) {
-            return json_error(400, "Missing required fields: firstName, lastName, email");
-        }
+            if (!body.has("firstName") || !body.has("lastName") || !body.has("email")) {
+                return json_error(400, "Missing required fields: firstName, lastName, email");
+            }
 
-        std::string firstName = trim(body["firstName"].s());
-        std::string lastName  = trim(body["lastName"].s());
-        std::string email     = trim(body["email"].s());
+            std::string_view firstName = trim_view(json_text(body["firstName"]));
+            std::string_view lastName  = trim_view(json_text(body["lastName"]));
+            std::string_view email     = trim_view(json_text(body["email"]));
 
-        if (firstName.empty() || lastName.empty() || email.empty()) {
-            return json_error(400, "Fields cannot be empty");
-        }
+            if (firstName.empty() || lastName.empty() || email.empty()) {
+                return json_error(400, "Fields cannot be empty");
+            }
 
-        if (!is_valid_email(email)) {
-            return json_error(400, "Invalid email format");
-        }
+            if (!is_valid_email(email)) {
+                return json_error(400, "Invalid email format");
+            }
 
-        const char* sql =
-            "UPDATE users SET firstName = ?, lastName = ?, email = ?, updatedAt = CURRENT_TIMESTAMP "
-            "WHERE id = ?;";
+            std::lock_guard<std::mutex> writer(shards.write_mutex(shards.shard_of_user(userId)));
+
+            // Sharded: move the email in the router first so uniqueness holds across shards
+            std::string previousEmail;
+            if (shards.sharded()) {
+                int rc = shards.update_user_email(userId, std::string(email), previousEmail);
+                if (rc == SQLITE_CONSTRAINT) {
+                    return json_error(409, "Email already exists");
+                }
+                if (rc != SQLITE_OK) {
+                    return json_error(500, "Failed to update user");
+                }
+            }
 
-        sqlite3_stmt* stmt = nullptr;
-        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-            return json_error(500, "Failed to prepare update");
-        }
+            const char* sql =
+                "UPDATE users SET firstName = ?, lastName = ?, email = ?, "
+                "version = version + 1, updatedAt = CURRENT_TIMESTAMP "
+                "WHERE id = ? RETURNING version;";
 
-        sqlite3_bind_text(stmt, 1, firstName.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_text(stmt, 2, lastName.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_text(stmt, 3, email.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_int(stmt, 4, userId);
+            sqlite3_stmt* stmt = nullptr;
+            if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+                return json_error(500, "Failed to prepare update");
+            }
 
-        int rc = sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
+            bind_text(stmt, 1, firstName);
+            bind_text(stmt, 2, lastName);
+            bind_text(stmt, 3, email);
+            sqlite3_bind_int(stmt, 4, userId);
 
-        if (rc != SQLITE_DONE) {
-            return json_error(500, "Failed to update user");
-        }
+            int rc = sqlite3_step(stmt);
+            long long version = (rc == SQLITE_ROW) ? sqlite3_column_int64(stmt, 0) : 0;
+            sqlite3_finalize(stmt);
 
-        crow::json::wvalue out;
-        out["id"] = userId;
-        out["firstName"] = firstName;
-        out["lastName"] = lastName;
-        out["email"] = email;
+            if (rc != SQLITE_ROW && !previousEmail.empty()) {
+                std::string ignored;
+                shards.update_user_email(userId, previousEmail, ignored);
+            }
+            if (rc == SQLITE_DONE) {
+                return json_error(404, "User not found");
+            }
+            if (rc == SQLITE_CONSTRAINT) {
+                return json_error(409, "Email already exists");
+            }
+            if (rc != SQLITE_ROW) {
+                return json_error(500, "Failed to update user");
+            }
 
-        crow::response res(200);
-        res.set_header("Content-Type", "application/json");
-        res.write(out.dump());
-        return res;
+            changes.publish(ChangeEntity::User, userId, ChangeOp::Update, version);
+
+            crow::json::wvalue out;
+            out["id"] = userId;
+            out["firstName"] = std::string(firstName);
+            out["lastName"] = std::string(lastName);
+            out["email"] = std::string(email);
+            out["version"] = version;
+
+            crow::response res(200);
+            res.set_header("Content-Type", "application/json");
+            set_etag(res, ETag::make("user-" + std::to_string(userId), version));
+            write_json(res, out);
+            return res;
+        });
     });
 
 
     // POST /users/:id/accounts -> create an account for a user
     CROW_ROUTE(app, "/users/<int>/accounts").methods(crow::HTTPMethod::POST)
-    ([db](const crow::request& req, int userId) {
-        if (!user_exists(db, userId)) {
-            return json_error(404, "User not found");
-        }
+    ([&shards, &existence, &changes, &executor](const crow::request& req, crow::response& res, int userId) {
+        run_db(executor, DbExecutor::Kind::Write, res, [&, userId] {
+            size_t shard = shards.shard_of_user(userId);
+            sqlite3* db = shards.shard(shard);
+
+            // Held from the user check through the insert, so a concurrent
+            // DELETE /users/:id cannot remove the owner in between
+            std::lock_guard<std::mutex> writer(shards.write_mutex(shard));
+            if (!existence.has_user(userId)) {
+                return json_error(404, "User not found");
+            }
 
-        auto body = crow::json::load(req.body);
-        if (!body) {
-            return json_error(400, "Invalid JSON");
-        }
+            auto body = parse_body(req);
+            if (!body) {
+                return json_error(400, "Invalid JSON");
+            }
 
-        if (!body.has("type")) {
-            return json_error(400, "Missing required field: type");
-        }
+            if (!body.has("type")) {
+                return json_error(400, "Missing required field: type");
+            }
 
-        std::string type = trim(body["type"].s());
-        if (type.empty()) {
-            return json_error(400, "type cannot be empty");
-        }
+            std::string_view type = trim_view(json_text(body["type"]));
+            if (type.empty()) {
+                return json_error(400, "type cannot be empty");
+            }
 
-        if (!is_allowed_account_type(type)) {
-            return json_error(400, "Invalid account type (allowed: checking, savings)");
-        }
+            if (!is_allowed_account_type(type)) {
+                return json_error(400, "Invalid account type (allowed: checking, savings)");
+            }
 
-        std::string status = "active";
-        if (body.has("status")) {
-            status = trim(body["status"].s());
-            if (status.empty()) {
-                return json_error(400, "status cannot be empty");
+            std::string_view status = "active";
+            if (body.has("status")) {
+                status = trim_view(json_text(body["status"]));
+                if (status.empty()) {
+                    return json_error(400, "status cannot be empty");
+                }
+                if (!is_allowed_account_status(status)) {
+                    return json_error(400, "Invalid account status (allowed: active, locked)");
+                }
             }
-            if (!is_allowed_account_status(status)) {
-                return json_error(400, "Invalid account status (allowed: active, locked)");
+
+            double balance = 0.0;
+            if (body.has("balance")) {
+                if (body["balance"].t() != crow::json::type::Number) {
+                return json_error(400, "balance must be a number");
+                }
+
+                balance = body["balance"].d();
+                if (balance < 0) {
+                    return json_error(400, "balance cannot be negative");
+                }
             }
-        }
 
-        double balance = 0.0;
-        if (body.has("balance")) {
-            if (body["balance"].t() != crow::json::type::Number) {
-            return json_error(400, "balance must be a number");
+            long long balanceCents = 0;
+            if (!to_cents(balance, balanceCents)) {
+                return json_error(400, "balance is out of range");
             }
+            balance = balanceCents / 100.0;
+
+            // The account starts at zero; an opening balance is its first ledger row.
+            // id is NULL (auto-assigned) unless sharded: then it must route back to this shard
+            const char* sql =
+                "INSERT INTO accounts (id, userId, type, status, balance, balanceCents) "
+                "VALUES (?, ?, ?, ?, 0, 0) RETURNING id;";
 
-            balance = body["balance"].d();
-            if (balance < 0) {
-                return json_error(400, "balance cannot be negative");
+            sqlite3_stmt* stmt = nullptr;
+            if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+                return json_error(500, "Failed to prepare insert");
             }
-        }
 
-        const char* sql =
-            "INSERT INTO accounts (userId, type, status, balance) "
-            "VALUES (?, ?, ?, ?);";
+            sqlite3_bind_int(stmt, 2, userId);
+            bind_text(stmt, 3, type);
+            bind_text(stmt, 4, status);
 
-        sqlite3_stmt* stmt = nullptr;
-        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-            return json_error(500, "Failed to prepare insert");
-        }
+            // The account row and its opening ledger row commit together: a failure
+            // leaves neither, so a retry cannot create a duplicate
+            Transaction txn(db);
+            if (!txn.active()) {
+                sqlite3_finalize(stmt);
+                return json_error(500, "Failed to create account");
+            }
 
-        sqlite3_bind_int(stmt, 1, userId);
-        sqlite3_bind_text(stmt, 2, type.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_text(stmt, 3, status.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_double(stmt, 4, balance);
+            if (shards.sharded()) {
+                sqlite3_bind_int64(stmt, 1, shards.next_account_id(shard));
+            } else {
+                sqlite3_bind_null(stmt, 1);
+            }
 
-        int rc = sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
+            int rc = sqlite3_step(stmt);
+            int newId = (rc == SQLITE_ROW) ? sqlite3_column_int(stmt, 0) : 0;
+            sqlite3_finalize(stmt);
 
-        if (rc != SQLITE_DONE) {
-            return json_error(500, "Failed to create account");
-        }
+            if (rc != SQLITE_ROW) {
+                return json_error(500, "Failed to create account");
+            }
 
-        int newId = static_cast<int>(sqlite3_last_insert_rowid(db));
+            long long version = 1;
+            if (balanceCents != 0) {
+                if (Database::record_balance_adjustment(db, newId, balanceCents, "Opening balance", true) != SQLITE_DONE) {
+                    return json_error(500, "Failed to record opening balance");
+                }
+                version = account_version(db, newId);
+            }
 
-        crow::json::wvalue out;
-        out["id"] = newId;
-        out["userId"] = userId;
-        out["type"] = type;
-        out["status"] = status;
-        out["balance"] = balance;
+            if (!txn.commit()) {
+                return json_error(500, "Failed to create account");
+            }
 
-        crow::response res(201);
-        res.set_header("Content-Type", "application/json");
-        res.write(out.dump());
-        return res;
+            existence.add_account(newId, userId);
+            changes.publish(ChangeEntity::Account, newId, ChangeOp::Create, version);
+
+            crow::json::wvalue out;
+            out["id"] = newId;
+            out["userId"] = userId;
+            out["type"] = std::string(type);
+            out["status"] = std::string(status);
+            out["balance"] = balance;
+            out["balanceCents"] = balanceCents;
+
+            crow::response res(201);
+            res.set_header("Content-Type", "application/json");
+            write_json(res, out);
+            return res;
+        });
+    });
+
+    // GET /accounts?ids=1,2,3 -> multi-get of accounts, results in request order
+    CROW_ROUTE(app, "/accounts").methods(crow::HTTPMethod::GET)
+    ([&shards, &existence, maxMultiGetIds, &executor](const crow::request& req, crow::response& res) {
+        run_db(executor, DbExecutor::Kind::Read, res, [&] {
+            if (!req.url_params.get("ids")) {
+                return json_error(400, "Missing required parameter: ids");
+            }
+
+            std::vector<int> ids;
+            std::string err;
+            if (!parse_id_list(req.url_params.get("ids"), maxMultiGetIds, ids, err)) {
+                return json_error(400, err);
+            }
+
+            long long accountsVersion = entity_version(shards, "accounts");
+            if (accountsVersion < 0) {
+                return json_error(500, "Failed to read accounts version");
+            }
+
+            std::string etag = ETag::make("accounts", accountsVersion);
+            if (etag_matches(req, etag)) {
+                return not_modified(etag);
+            }
+
+            std::string sql = std::string("SELECT ") + kAccountColumns +
+                              " FROM accounts WHERE id IN (SELECT value FROM json_each(?));";
+
+            // One query per shard that owns any of the ids; unknown ids never reach SQLite
+            std::vector<std::vector<int>> idsByShard(shards.size());
+            for (int id : ids) {
+                if (existence.has_account(id)) {
+                    idsByShard[shards.shard_of_account(id)].push_back(id);
+                }
+            }
+
+            std::map<int, crow::json::wvalue> found;
+            for (size_t s = 0; s < shards.size(); ++s) {
+                if (idsByShard[s].empty()) continue;
+
+                sqlite3_stmt* stmt = nullptr;
+                if (sqlite3_prepare_v2(shards.shard(s), sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+                    return json_error(500, "Failed to prepare query");
+                }
+
+                std::string idsJson = ids_to_json_array(idsByShard[s]);
+                sqlite3_bind_text(stmt, 1, idsJson.c_str(), -1, SQLITE_TRANSIENT);
+
+                while (sqlite3_step(stmt) == SQLITE_ROW) {
+                    found[sqlite3_column_int(stmt, 0)] = account_json(stmt);
+                }
+                sqlite3_finalize(stmt);
+            }
+
+            crow::json::wvalue result;
+            result["accounts"] = crow::json::wvalue::list();
+
+            int i = 0;
+            for (int id : ids) {
+                auto it = found.find(id);
+                if (it == found.end()) {
+                    result["accounts"][i++] = not_found_marker(id, "Account not found");
+                } else {
+                    result["accounts"][i++] = crow::json::wvalue(it->second);
+                }
+            }
+
+            crow::response res(200);
+            res.set_header("Content-Type", "application/json");
+            set_etag(res, etag);
+            write_json(res, result);
+            return res;
+        });
     });
 
     // PATCH /accounts/:id -> partial update of an account
     CROW_ROUTE(app, "/accounts/<int>").methods(crow::HTTPMethod::PATCH)
-    ([db](const crow::request& req, int accountId) {
-        if (!account_exists(db, accountId)) {
-            return json_error(404, "Account not found");
-        }
-        // Fetch current account status
-        std::string currentStatus;
-        {
-            const char* statusSql = "SELECT status FROM accounts WHERE id = ?;";
-            sqlite3_stmt* statusStmt = nullptr;
+    ([&shards, &existence, &changes, &app, &executor](const crow::request& req, crow::response& res, int accountId) {
+        run_db(executor, DbExecutor::Kind::Write, res, [&, accountId] {
+            std::pmr::memory_resource* mem = request_memory(app, req);
+            sqlite3* db = shards.for_account(accountId);
 
-            if (sqlite3_prepare_v2(db, statusSql, -1, &statusStmt, nullptr) != SQLITE_OK) {
-                return json_error(500, "Failed to read account status");
+            if (!existence.has_account(accountId)) {
+                return json_error(404, "Account not found");
             }
 
-            sqlite3_bind_int(statusStmt, 1, accountId);
+            // Held from the status check through the writes, so no other write
+            // to this shard (e.g. a concurrent lock) lands in between
+            std::lock_guard<std::mutex> writer(shards.write_mutex(shards.shard_of_account(accountId)));
 
-            int rc = sqlite3_step(statusStmt);
-            if (rc != SQLITE_ROW) {
+            // Fetch current account status
+            std::pmr::string currentStatus(mem);
+            {
+                const char* statusSql = "SELECT status FROM accounts WHERE id = ?;";
+                sqlite3_stmt* statusStmt = nullptr;
+
+                if (sqlite3_prepare_v2(db, statusSql, -1, &statusStmt, nullptr) != SQLITE_OK) {
+                    return json_error(500, "Failed to read account status");
+                }
+
+                sqlite3_bind_int(statusStmt, 1, accountId);
+
+                int rc = sqlite3_step(statusStmt);
+                if (rc != SQLITE_ROW) {
+                    sqlite3_finalize(statusStmt);
+                    return json_error(404, "Account not found");
+                }
+
+                currentStatus = reinterpret_cast<const char*>(sqlite3_column_text(statusStmt, 0));
                 sqlite3_finalize(statusStmt);
-                return json_error(404, "Account not found");
+            }
+            auto body = parse_body(req);
+            if (!body) {
+                return json_error(400, "Invalid JSON");
             }
 
-            currentStatus = reinterpret_cast<const char*>(sqlite3_column_text(statusStmt, 0));
-            sqlite3_finalize(statusStmt);
-        }
-        auto body = crow::json::load(req.body);
-        if (!body) {
-            return json_error(400, "Invalid JSON");
-        }
+            // Allowed fields
+            bool hasType = body.has("type");
+            bool hasStatus = body.has("status");
+            bool hasBalance = body.has("balance");
 
-        // Allowed fields
-        bool hasType = body.has("type");
-        bool hasStatus = body.has("status");
-        bool hasBalance = body.has("balance");
+            // Rule: locked accounts cannot change balance
+            if (currentStatus == "locked" && hasBalance) {
+                return json_error(400, "Cannot update balance on a locked account");
+            }
 
-        // Rule: locked accounts cannot change balance
-        if (currentStatus == "locked" && hasBalance) {
-            return json_error(400, "Cannot update balance on a locked account");
-        }
+            // Rule: locked accounts cannot be unlocked
+            if (currentStatus == "locked" && hasStatus) {
+                std::string_view newStatus = trim_view(json_text(body["status"]));
+                if (newStatus == "active") {
+                    return json_error(400, "Locked accounts cannot be reactivated");
+                }
+            }
 
-        // Rule: locked accounts cannot be unlocked
-        if (currentStatus == "locked" && hasStatus) {
-            std::string newStatus = trim(body["status"].s());
-            if (newStatus == "active") {
-                return json_error(400, "Locked accounts cannot be reactivated");
+            if (!hasType && !hasStatus && !hasBalance) {
+                return json_error(400, "No valid fields to update (allowed: type, status, balance)");
             }
-        }
 
-        if (!hasType && !hasStatus && !hasBalance) {
-            return json_error(400, "No valid fields to update (allowed: type, status, balance)");
-        }
+            // Reject unknown fields (catches typos)
+            for (const auto& kv : body) {
+                std::string key = kv.key();
+                if (key != "type" && key != "status" && key != "balance") {
+                    return json_error(400, "Unknown field: " + key);
+                }
+            }
+
+            std::string_view type;
+            std::string_view status;
+            double balance = 0.0;
 
-        // Reject unknown fields (catches typos)
-        for (const auto& kv : body) {
-            std::string key = kv.key();
-            if (key != "type" && key != "status" && key != "balance") {
-                return json_error(400, "Unknown field: " + key);
+            if (hasType) {
+                type = json_text(body["type"]);
+                if (type.empty()) {
+                    return json_error(400, "type cannot be empty");
+                }
             }
-        }
 
-        std::string type;
-        std::string status;
-        double balance = 0.0;
+            if (hasStatus) {
+                status = json_text(body["status"]);
+                if (status.empty()) {
+                    return json_error(400, "status cannot be empty");
+                }
+            }
 
-        if (hasType) {
-            type = body["type"].s();
-            if (type.empty()) {
-                return json_error(400, "type cannot be empty");
+            long long balanceCents = 0;
+            if (hasBalance) {
+                balance = body["balance"].d();
+                if (balance < 0) {
+                    return json_error(400, "balance cannot be negative");
+                }
+                if (!to_cents(balance, balanceCents)) {
+                    return json_error(400, "balance is out of range");
+                }
             }
-        }
 
-        if (hasStatus) {
-            status = body["status"].s();
-            if (status.empty()) {
-                return json_error(400, "status cannot be empty");
+            // The adjustment and the type/status update commit together or not at all
+            Transaction txn(db);
+            if (!txn.active()) {
+                return json_error(500, "Failed to update account");
             }
-        }
 
-        if (hasBalance) {
-            balance = body["balance"].d();
-            if (balance < 0) {
-                return json_error(400, "balance cannot be negative");
+            // An absolute balance goes through the ledger as an adjustment row (applied
+            // before a status change, so a PATCH that also locks the account still works).
+            // The statement itself skips locked accounts, so the check above is not the
+            // only guard.
+            if (hasBalance &&
+                Database::record_balance_adjustment(db, accountId, balanceCents, "Balance adjustment", false) != SQLITE_DONE) {
+                return json_error(500, "Failed to update account");
             }
-        }
 
-        // Build UPDATE dynamically
-        std::string sql = "UPDATE accounts SET ";
-        bool first = true;
+            if (hasType || hasStatus) {
+                // Build UPDATE dynamically (in the request arena)
+                std::pmr::string sql("UPDATE accounts SET ", mem);
+                if (hasType) {
+                    sql += "type = ?, ";
+                }
+                if (hasStatus) {
+                    sql += "status = ?, ";
+                }
+
+                // Always bump version and updatedAt when PATCH succeeds
+                sql += "version = version + 1, updatedAt = CURRENT_TIMESTAMP";
+                sql += " WHERE id = ?;";
+
+                sqlite3_stmt* stmt = nullptr;
+                if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+                    return json_error(500, "Failed to prepare update");
+                }
+
+                int idx = 1;
+                if (hasType) {
+                    bind_text(stmt, idx++, type);
+                }
+                if (hasStatus) {
+                    bind_text(stmt, idx++, status);
+                }
+
+                sqlite3_bind_int(stmt, idx++, accountId);
+
+                int rc = sqlite3_step(stmt);
+                sqlite3_finalize(stmt);
+
+                if (rc != SQLITE_DONE) {
+                    return json_error(500, "Failed to update account");
+                }
+            }
 
-        if (hasType) {
-            sql += "type = ?";
-            first = false;
-        }
-        if (hasStatus) {
-            if (!first) sql += ", ";
-            sql += "status = ?";
-            first = false;
-        }
-        if (hasBalance) {
-            if (!first) sql += ", ";
-            sql += "balance = ?";
-            first = false;
-        }
+            if (!txn.commit()) {
+                return json_error(500, "Failed to update account");
+            }
 
-        // Always update updatedAt when PATCH succeeds
-        sql += ", updatedAt = CURRENT_TIMESTAMP";
-        sql += " WHERE id = ?;";
+            // Return updated account
+            const char* selectSql =
+                "SELECT id, userId, type, status, balance, createdAt, updatedAt, version, balanceCents "
+                "FROM accounts WHERE id = ?;";
 
-        sqlite3_stmt* stmt = nullptr;
-        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-            return json_error(500, "Failed to prepare update");
-        }
+            sqlite3_stmt* stmt2 = nullptr;
+            if (sqlite3_prepare_v2(db, selectSql, -1, &stmt2, nullptr) != SQLITE_OK) {
+                return json_error(500, "Failed to prepare query");
+            }
 
-        int idx = 1;
-        if (hasType) {
-            sqlite3_bind_text(stmt, idx++, type.c_str(), -1, SQLITE_TRANSIENT);
-        }
-        if (hasStatus) {
-            sqlite3_bind_text(stmt, idx++, status.c_str(), -1, SQLITE_TRANSIENT);
-        }
-        if (hasBalance) {
-            sqlite3_bind_double(stmt, idx++, balance);
-        }
+            sqlite3_bind_int(stmt2, 1, accountId);
 
-        sqlite3_bind_int(stmt, idx++, accountId);
+            int rc2 = sqlite3_step(stmt2);
+            if (rc2 != SQLITE_ROW) {
+                sqlite3_finalize(stmt2);
+                return json_error(500, "Failed to read updated account");
+            }
 
-        int rc = sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
+            crow::json::wvalue out;
+            out["id"] = sqlite3_column_int(stmt2, 0);
+            out["userId"] = sqlite3_column_int(stmt2, 1);
+            out["type"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt2, 2));
+            out["status"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt2, 3));
+            out["balance"] = sqlite3_column_double(stmt2, 4);
+            out["createdAt"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt2, 5));
+            out["updatedAt"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt2, 6));
 
-        if (rc != SQLITE_DONE) {
-            return json_error(500, "Failed to update account");
-        }
+            long long version = sqlite3_column_int64(stmt2, 7);
+            out["version"] = version;
+            changes.publish(ChangeEntity::Account, accountId, ChangeOp::Update, version);
+            out["balanceCents"] = sqlite3_column_int64(stmt2, 8);
 
-        // Return updated account
-        const char* selectSql =
-            "SELECT id, userId, type, status, balance, createdAt, updatedAt "
-            "FROM accounts WHERE id = ?;";
+            sqlite3_finalize(stmt2);
 
-        sqlite3_stmt* stmt2 = nullptr;
-        if (sqlite3_prepare_v2(db, selectSql, -1, &stmt2, nullptr) != SQLITE_OK) {
-            return json_error(500, "Failed to prepare query");
-        }
+            crow::response res(200);
+            res.set_header("Content-Type", "application/json");
+            set_etag(res, ETag::make("account-" + std::to_string(accountId), version));
+            write_json(res, out);
+            return res;
+        });
+    });
+    // DELETE /accounts/:id -> delete an account
+    CROW_ROUTE(app, "/accounts/<int>").methods(crow::HTTPMethod::DELETE)
+    ([&shards, &existence, &changes, &executor](crow::response& res, int accountId) {
+        run_db(executor, DbExecutor::Kind::Write, res, [&, accountId] {
+            sqlite3* db = shards.for_account(accountId);
+            if (!existence.has_account(accountId)) {
+                return json_error(404, "Account not found");
+            }
 
-        sqlite3_bind_int(stmt2, 1, accountId);
+            std::lock_guard<std::mutex> writer(shards.write_mutex(shards.shard_of_account(accountId)));
 
-        int rc2 = sqlite3_step(stmt2);
-        if (rc2 != SQLITE_ROW) {
-            sqlite3_finalize(stmt2);
-            return json_error(500, "Failed to read updated account");
-        }
+            const char* sql = "DELETE FROM accounts WHERE id = ? RETURNING version, userId;";
+            sqlite3_stmt* stmt = nullptr;
 
-        crow::json::wvalue out;
-        out["id"] = sqlite3_column_int(stmt2, 0);
-        out["userId"] = sqlite3_column_int(stmt2, 1);
-        out["type"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt2, 2));
-        out["status"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt2, 3));
-        out["balance"] = sqlite3_column_double(stmt2, 4);
-        out["createdAt"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt2, 5));
-        out["updatedAt"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt2, 6));
+            if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+                return json_error(500, "Failed to prepare delete");
+            }
 
-        sqlite3_finalize(stmt2);
+            sqlite3_bind_int(stmt, 1, accountId);
 
-        crow::response res(200);
-        res.set_header("Content-Type", "application/json");
-        res.write(out.dump());
-        return res;
+            int rc = sqlite3_step(stmt);
+            long long version = (rc == SQLITE_ROW) ? sqlite3_column_int64(stmt, 0) : 0;
+            int ownerId = (rc == SQLITE_ROW) ? sqlite3_column_int(stmt, 1) : 0;
+            sqlite3_finalize(stmt);
+
+            if (rc == SQLITE_DONE) {
+                return json_error(404, "Account not found");
+            }
+            if (rc != SQLITE_ROW) {
+                return json_error(500, "Failed to delete account");
+            }
+
+            existence.remove_account(accountId, ownerId);
+            changes.publish(ChangeEntity::Account, accountId, ChangeOp::Delete, version);
+
+            // 204 No Content
+            return crow::response(204);
+        });
     });
-    // DELETE /accounts/:id -> delete an account
-    CROW_ROUTE(app, "/accounts/<int>").methods(crow::HTTPMethod::DELETE)
-    ([db](int accountId) {
-        if (!account_exists(db, accountId)) {
-            return json_error(404, "Account not found");
-        }
 
-        const char* sql = "DELETE FROM accounts WHERE id = ?;";
-        sqlite3_stmt* stmt = nullptr;
+    // POST /accounts/:id/transactions -> apply a signed balance delta (integer cents)
+    CROW_ROUTE(app, "/accounts/<int>/transactions").methods(crow::HTTPMethod::POST)
+    ([&shards, &existence, &changes, &executor](const crow::request& req, crow::response& res, int accountId) {
+        run_db(executor, DbExecutor::Kind::Write, res, [&, accountId] {
+            sqlite3* db = shards.for_account(accountId);
+            auto body = parse_body(req);
+            if (!body) {
+                return json_error(400, "Invalid JSON");
+            }
 
-        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-            return json_error(500, "Failed to prepare delete");
-        }
+            if (!body.has("amountCents")) {
+                return json_error(400, "Missing required field: amountCents");
+            }
+
+            if (body["amountCents"].t() != crow::json::type::Number ||
+                body["amountCents"].nt() == crow::json::num_type::Floating_point) {
+                return json_error(400, "amountCents must be an integer");
+            }
+
+            long long amountCents = body["amountCents"].i();
+            if (amountCents == 0) {
+                return json_error(400, "amountCents cannot be zero");
+            }
+            if (amountCents > kMaxTransactionCents || amountCents < -kMaxTransactionCents) {
+                return json_error(400, "amountCents is out of range");
+            }
+
+            std::string description;
+            if (body.has("description")) {
+                if (body["description"].t() != crow::json::type::String) {
+                    return json_error(400, "description must be a string");
+                }
+                description = trim(body["description"].s());
+                if (description.length() > 255) {
+                    return json_error(400, "description must be at most 255 characters");
+                }
+            }
 
-        sqlite3_bind_int(stmt, 1, accountId);
+            std::lock_guard<std::mutex> writer(shards.write_mutex(shards.shard_of_account(accountId)));
 
-        int rc = sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
+            // One statement: the ledger row is only inserted when the account is
+            // active and stays within [0, kMaxTransactionCents], and its trigger
+            // applies the delta.
+            const char* sql =
+                "INSERT INTO transactions (accountId, amountCents, balanceAfterCents, description) "
+                "SELECT id, ?, balanceCents + ?, ? FROM accounts "
+                "WHERE id = ? AND status <> 'locked' AND balanceCents + ? BETWEEN 0 AND ? "
+                "RETURNING id, balanceAfterCents, createdAt;";
 
-        if (rc != SQLITE_DONE) {
-            return json_error(500, "Failed to delete account");
-        }
+            sqlite3_stmt* stmt = nullptr;
+            if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+                return json_error(500, "Failed to prepare transaction");
+            }
+
+            sqlite3_bind_int64(stmt, 1, amountCents);
+            sqlite3_bind_int64(stmt, 2, amountCents);
+            if (description.empty()) {
+                sqlite3_bind_null(stmt, 3);
+            } else {
+                sqlite3_bind_text(stmt, 3, description.c_str(), -1, SQLITE_TRANSIENT);
+            }
+            sqlite3_bind_int(stmt, 4, accountId);
+            sqlite3_bind_int64(stmt, 5, amountCents);
+            sqlite3_bind_int64(stmt, 6, kMaxTransactionCents);
+
+            int rc = sqlite3_step(stmt);
+            if (rc != SQLITE_ROW) {
+                sqlite3_finalize(stmt);
+                if (rc != SQLITE_DONE) {
+                    return json_error(500, "Failed to apply transaction");
+                }
+
+                // Nothing inserted: work out which rule rejected it
+                if (!existence.has_account(accountId)) {
+                    return json_error(404, "Account not found");
+                }
+
+                const char* statusSql = "SELECT status, balanceCents FROM accounts WHERE id = ?;";
+                sqlite3_stmt* statusStmt = nullptr;
+                if (sqlite3_prepare_v2(db, statusSql, -1, &statusStmt, nullptr) != SQLITE_OK) {
+                    return json_error(500, "Failed to read account status");
+                }
+                sqlite3_bind_int(statusStmt, 1, accountId);
+
+                bool locked = false;
+                long long currentCents = 0;
+                if (sqlite3_step(statusStmt) == SQLITE_ROW) {
+                    locked = std::string(reinterpret_cast<const char*>(
+                        sqlite3_column_text(statusStmt, 0))) == "locked";
+                    currentCents = sqlite3_column_int64(statusStmt, 1);
+                }
+                sqlite3_finalize(statusStmt);
+
+                if (locked) {
+                    return json_error(400, "Cannot update balance on a locked account");
+                }
+                if (currentCents + amountCents > kMaxTransactionCents) {
+                    return json_error(409, "Balance limit exceeded: balance cannot exceed 1000000000.00");
+                }
+                return json_error(409, "Insufficient funds: balance cannot be negative");
+            }
+
+            crow::json::wvalue out;
+            out["id"] = sqlite3_column_int64(stmt, 0);
+            out["accountId"] = accountId;
+            out["amountCents"] = amountCents;
+            out["balanceAfterCents"] = sqlite3_column_int64(stmt, 1);
+            out["createdAt"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+            if (!description.empty()) {
+                out["description"] = description;
+            }
+
+            sqlite3_finalize(stmt);
+
+            changes.publish(ChangeEntity::Account, accountId, ChangeOp::Update,
+                            account_version(db, accountId));
+
+            crow::response res(201);
+            res.set_header("Content-Type", "application/json");
+            write_json(res, out);
+            return res;
+        });
+    });
+
+    // GET /accounts/:id/transactions -> paginated ledger, newest first
+    CROW_ROUTE(app, "/accounts/<int>/transactions").methods(crow::HTTPMethod::GET)
+    ([&shards, &existence, &executor](const crow::request& req, crow::response& res, int accountId) {
+        run_db(executor, DbExecutor::Kind::Read, res, [&, accountId] {
+            sqlite3* db = shards.for_account(accountId);
+            if (!existence.has_account(accountId)) {
+                return json_error(404, "Account not found");
+            }
+
+            int page = 1;
+            int limit = 20;
+
+            if (req.url_params.get("page")) {
+                page = std::stoi(req.url_params.get("page"));
+            }
+            if (req.url_params.get("limit")) {
+                limit = std::stoi(req.url_params.get("limit"));
+            }
+
+            if (page < 1) {
+                return json_error(400, "page must be >= 1");
+            }
 
-        // 204 No Content
-        return crow::response(204);
+            if (limit < 1 || limit > 100) {
+                return json_error(400, "limit must be between 1 and 100");
+            }
+
+            int total = 0;
+            {
+                const char* countSql = "SELECT COUNT(*) FROM transactions WHERE accountId = ?;";
+                sqlite3_stmt* countStmt = nullptr;
+
+                if (sqlite3_prepare_v2(db, countSql, -1, &countStmt, nullptr) != SQLITE_OK) {
+                    return json_error(500, "Failed to prepare query");
+                }
+
+                sqlite3_bind_int(countStmt, 1, accountId);
+                if (sqlite3_step(countStmt) == SQLITE_ROW) {
+                    total = sqlite3_column_int(countStmt, 0);
+                }
+                sqlite3_finalize(countStmt);
+            }
+
+            const char* sql =
+                "SELECT id, amountCents, balanceAfterCents, description, createdAt "
+                "FROM transactions WHERE accountId = ? ORDER BY id DESC LIMIT ? OFFSET ?;";
+
+            sqlite3_stmt* stmt = nullptr;
+            if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+                return json_error(500, "Failed to prepare query");
+            }
+
+            sqlite3_bind_int(stmt, 1, accountId);
+            sqlite3_bind_int(stmt, 2, limit);
+            sqlite3_bind_int64(stmt, 3, static_cast<long long>(page - 1) * limit);
+
+            crow::json::wvalue result;
+            result["page"] = page;
+            result["limit"] = limit;
+            result["total"] = total;
+            result["transactions"] = crow::json::wvalue::list();
+
+            int i = 0;
+            while (sqlite3_step(stmt) == SQLITE_ROW) {
+                crow::json::wvalue t;
+                t["id"] = sqlite3_column_int64(stmt, 0);
+                t["accountId"] = accountId;
+                t["amountCents"] = sqlite3_column_int64(stmt, 1);
+                t["balanceAfterCents"] = sqlite3_column_int64(stmt, 2);
+                if (sqlite3_column_type(stmt, 3) != SQLITE_NULL) {
+                    t["description"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
+                }
+                t["createdAt"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4));
+                result["transactions"][i++] = std::move(t);
+            }
+
+            sqlite3_finalize(stmt);
+
+            crow::response res(200);
+            res.set_header("Content-Type", "application/json");
+            write_json(res, result);
+            return res;
+        });
     });
 
     // DELETE /users/:id -> delete a user (only if no accounts exist)
     CROW_ROUTE(app, "/users/<int>").methods(crow::HTTPMethod::DELETE)
-    ([db](int userId) {
-        if (!user_exists(db, userId)) {
-            return json_error(404, "User not found");
-        }
+    ([&shards, &existence, &changes, &executor](crow::response& res, int userId) {
+        run_db(executor, DbExecutor::Kind::Write, res, [&, userId] {
+            sqlite3* db = shards.for_user(userId);
+            if (!existence.has_user(userId)) {
+                return json_error(404, "User not found");
+            }
 
-        // Task 7 guard: prevent deletion if accounts exist
-        if (user_has_accounts(db, userId)) {
-            return json_error(409, "Cannot delete user with existing accounts");
-        }
+            // Taken before the guard: account inserts for this user hold the same lock
+            std::lock_guard<std::mutex> writer(shards.write_mutex(shards.shard_of_user(userId)));
 
-        const char* sql = "DELETE FROM users WHERE id = ?;";
-        sqlite3_stmt* stmt = nullptr;
+            // Task 7 guard: prevent deletion if accounts exist
+            if (existence.user_has_accounts(userId)) {
+                return json_error(409, "Cannot delete user with existing accounts");
+            }
 
-        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-            return json_error(500, "Failed to prepare delete");
-        }
+            const char* sql = "DELETE FROM users WHERE id = ? RETURNING version;";
+            sqlite3_stmt* stmt = nullptr;
 
-        sqlite3_bind_int(stmt, 1, userId);
+            if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+                return json_error(500, "Failed to prepare delete");
+            }
 
-        int rc = sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
+            sqlite3_bind_int(stmt, 1, userId);
 
-        if (rc != SQLITE_DONE) {
-            return json_error(500, "Failed to delete user");
-        }
+            int rc = sqlite3_step(stmt);
+            long long version = (rc == SQLITE_ROW) ? sqlite3_column_int64(stmt, 0) : 0;
+            sqlite3_finalize(stmt);
 
-        // 204 No Content
-        return crow::response(204);
+            if (rc == SQLITE_DONE) {
+                return json_error(404, "User not found");
+            }
+            if (rc != SQLITE_ROW) {
+                return json_error(500, "Failed to delete user");
+            }
+
+            if (shards.sharded()) {
+                shards.release_user(userId);
+            }
+            existence.remove_user(userId);
+
+            changes.publish(ChangeEntity::User, userId, ChangeOp::Delete, version);
+
+            // 204 No Content
+            return crow::response(204);
+        });
     });
 
 
@@ -928,8 +2667,96 @@ int main() {
         }
     }
 
-    app.port(port).multithreaded().run();
+    app.signal_clear();
+    auto server = app.port(port).multithreaded().run_async();
+    app.wait_for_server_start();
+
+    // Orderly stop: refuse new DB work and finish what is queued while the I/O
+    // threads can still deliver the responses, then stop the app
+    std::atomic<bool> shuttingDown{false};
+    std::thread shutdownThread([&] {
+        int sig = 0;
+        sigwait(&shutdownSignals, &sig);
+        shuttingDown.store(true);
+
+        std::cout << "Shutting down: draining database queues" << std::endl;
+        executor.shutdown();
+
+        Profiler::shutdown();
+        std::thread profile;
+        {
+            std::lock_guard<std::mutex> lock(profileMutex);
+            profilesClosed = true;
+            profile.swap(profileThread);
+        }
+        if (profile.joinable()) {
+            profile.join();
+        }
+
+        // Parked /changes long-polls and SSE requests get their reply now
+        changes.shutdown();
+        app.stop();
+    });
+
+    // Warm-up runs while /health already answers: WARMUP=0 skips the preload,
+    // WARMUP_REQUESTS=N replays N rounds of the read routes against ourselves
+    std::thread warmupThread([&] {
+        std::vector<std::string> files = ShardSet::file_paths(dbPath, shardCount);
+        std::vector<sqlite3*> conns = shards.connections();
+
+        if (env_long("WARMUP", 1) != 0) {
+            for (size_t i = 0; i < conns.size(); ++i) {
+                WarmupStats st = Warmup::preload(conns[i], files[i],
+                                                 env_long("WARMUP_CACHE_MB", 0),
+                                                 env_long("WARMUP_MMAP_MB", 0));
+                if (!st.error.empty()) {
+                    std::cerr << "Warm-up of " << files[i] << " failed: " << st.error << "\n";
+                }
+                warmupStats.fileBytes += st.fileBytes;
+                warmupStats.btrees += st.btrees;
+                warmupStats.durationMs += st.durationMs;
+            }
+        }
+
+        long rounds = env_long("WARMUP_REQUESTS", 0);
+        if (rounds > 0) {
+            auto start = std::chrono::steady_clock::now();
+            std::vector<std::string> paths = {
+                "/users?limit=100",
+                "/users?limit=10&include=accounts",
+            };
+            // One user and one account from every shard, so each file's routes are warmed
+            for (size_t i = 0; i < shards.size(); ++i) {
+                if (int userId = first_id(shards.shard(i), "users")) {
+                    paths.push_back("/users/" + std::to_string(userId));
+                    paths.push_back("/users/" + std::to_string(userId) + "/accounts");
+                }
+                if (int accountId = first_id(shards.shard(i), "accounts")) {
+                    paths.push_back("/accounts?ids=" + std::to_string(accountId));
+                    paths.push_back("/accounts/" + std::to_string(accountId) + "/transactions");
+                }
+            }
+            for (long r = 0; r < rounds; ++r) {
+                for (const auto& path : paths) {
+                    local_get(port, path);
+                }
+            }
+            warmupStats.durationMs += std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        }
+
+        std::cout << "Warm-up finished in " << warmupStats.durationMs << "ms" << std::endl;
+        ready.store(true, std::memory_order_release);
+    });
+
+    server.wait();
+    if (!shuttingDown.load()) {
+        kill(getpid(), SIGTERM);    // the server stopped on its own; release the shutdown thread
+    }
+    shutdownThread.join();
+    warmupThread.join();
 
-    sqlite3_close(db);
+    // Backups stop first, then ShardSet closes the connections
+    backups.reset();
     return 0;
 }
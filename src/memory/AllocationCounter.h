@@ -0,0 +1,11 @@
+#pragma once
+#include <cstddef>
+
+// Opt-in count of global operator new calls, for benchmark runs only. Built
+// with -DCOUNT_HEAP_ALLOCATIONS (Dockerfile: PROFILE=alloc-count) the global
+// allocator is replaced by a counting wrapper around malloc; otherwise this
+// file adds nothing to the binary. Compare heap_allocations() before and
+// after a load test (GET /debug/allocations) to get allocations per request.
+#ifdef COUNT_HEAP_ALLOCATIONS
+std::size_t heap_allocations();
+#endif
@@ -0,0 +1,58 @@
+#include "RequestArena.h"
+
+#include <mutex>
+#include <vector>
+
+// Only the owning thread takes arenas out; any thread may put one back, so
+// the mutex is normally uncontended. Freed (with its arenas) at thread exit.
+struct RequestArena::FreeList {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<RequestArena>> arenas;
+};
+
+RequestArena::RequestArena(std::weak_ptr<FreeList> owner)
+    : monotonic_(buffer_, kBufferSize, std::pmr::new_delete_resource()),
+      owner_(std::move(owner)) {}
+
+RequestArena* RequestArena::acquire() {
+    thread_local std::shared_ptr<FreeList> freeList = std::make_shared<FreeList>();
+
+    RequestArena* arena = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(freeList->mutex);
+        if (!freeList->arenas.empty()) {
+            arena = freeList->arenas.back().release();
+            freeList->arenas.pop_back();
+        }
+    }
+    if (!arena) {
+        arena = new RequestArena(freeList);
+    }
+
+    arena->allocations_ = 0;
+    arena->bytes_ = 0;
+    return arena;
+}
+
+void RequestArena::release(RequestArena* arena) {
+    if (!arena) return;
+
+    // Drops any spilled heap blocks and rewinds to the start of the buffer
+    arena->monotonic_.release();
+
+    // The owning thread may have exited; then the arena is simply freed
+    if (std::shared_ptr<FreeList> freeList = arena->owner_.lock()) {
+        std::lock_guard<std::mutex> lock(freeList->mutex);
+        if (freeList->arenas.size() < kMaxFreeArenas) {
+            freeList->arenas.emplace_back(arena);
+            return;
+        }
+    }
+    delete arena;
+}
+
+void* RequestArena::do_allocate(std::size_t bytes, std::size_t alignment) {
+    ++allocations_;
+    bytes_ += bytes;
+    return monotonic_.allocate(bytes, alignment);
+}
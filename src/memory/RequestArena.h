@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+// Monotonic arena for one request's temporaries. Each thread keeps a small
+// free list of arenas whose 64 KiB backing buffers survive across requests,
+// so the common case never touches malloc; larger requests spill to the heap
+// and everything is released in one step when the request ends.
+class RequestArena final : public std::pmr::memory_resource {
+public:
+    static constexpr std::size_t kBufferSize = 64 * 1024;
+
+    // Arenas kept per thread; more only exist while requests overlap
+    static constexpr std::size_t kMaxFreeArenas = 4;
+
+    // An arena from this thread's free list (a new one if the list is empty)
+    static RequestArena* acquire();
+
+    // Rewinds `arena` and returns it to the free list of the thread that
+    // acquired it; safe to call from any thread
+    static void release(RequestArena* arena);
+
+    std::size_t allocations() const { return allocations_; }
+    std::size_t bytes() const { return bytes_; }
+
+    RequestArena(const RequestArena&) = delete;
+    RequestArena& operator=(const RequestArena&) = delete;
+
+private:
+    struct FreeList;
+
+    explicit RequestArena(std::weak_ptr<FreeList> owner);
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void*, std::size_t, std::size_t) override {}
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    alignas(std::max_align_t) unsigned char buffer_[kBufferSize];
+    std::pmr::monotonic_buffer_resource monotonic_;
+    const std::weak_ptr<FreeList> owner_;
+    std::size_t allocations_ = 0;
+    std::size_t bytes_ = 0;
+};
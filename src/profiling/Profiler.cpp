@@ -0,0 +1,359 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <link.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr int kMaxFrames = 48;
+constexpr size_t kMaxSamples = 1 << 15;
+
+struct Sample {
+    std::atomic<int> depth{0};      // set last: 0 means not (fully) written
+    uintptr_t frames[kMaxFrames];
+};
+
+struct Session {
+    std::unique_ptr<Sample[]> samples{new Sample[kMaxSamples]};
+    std::atomic<size_t> next{0};
+    pid_t pid = getpid();
+};
+
+std::atomic<bool> gRunning{false};
+std::atomic<Session*> gSession{nullptr};
+std::atomic<int> gInHandler{0};     // handlers that may still touch a session
+
+std::mutex gWaitMutex;
+std::condition_variable gWaitCv;
+bool gShutdown = false;             // guarded by gWaitMutex
+
+// Reads two words at `fp` without faulting on a bad address
+bool read_frame(pid_t pid, uintptr_t fp, uintptr_t out[2]) {
+    iovec local{out, 2 * sizeof(uintptr_t)};
+    iovec remote{reinterpret_cast<void*>(fp), 2 * sizeof(uintptr_t)};
+    return process_vm_readv(pid, &local, 1, &remote, 1, 0) == static_cast<ssize_t>(2 * sizeof(uintptr_t));
+}
+
+// Async-signal-safe: no locks, no allocation
+void record_sample(Session* session, void* context);
+
+void on_sigprof(int, siginfo_t*, void* context) {
+    int savedErrno = errno;
+
+    // Store-then-load on both sides (here and in collect()): only seq_cst keeps
+    // collect() from reading gInHandler == 0 while this handler still sees the
+    // session it is about to free
+    gInHandler.fetch_add(1, std::memory_order_seq_cst);
+    Session* session = gSession.load(std::memory_order_seq_cst);
+    if (session) {
+        record_sample(session, context);
+    }
+    gInHandler.fetch_sub(1, std::memory_order_seq_cst);
+
+    errno = savedErrno;
+}
+
+void record_sample(Session* session, void* context) {
+    size_t slot = session->next.fetch_add(1, std::memory_order_relaxed);
+    if (slot >= kMaxSamples) {
+        return;
+    }
+
+    const mcontext_t& mc = static_cast<ucontext_t*>(context)->uc_mcontext;
+#if defined(__x86_64__)
+    uintptr_t pc = static_cast<uintptr_t>(mc.gregs[REG_RIP]);
+    uintptr_t fp = static_cast<uintptr_t>(mc.gregs[REG_RBP]);
+#elif defined(__aarch64__)
+    uintptr_t pc = static_cast<uintptr_t>(mc.pc);
+    uintptr_t fp = static_cast<uintptr_t>(mc.regs[29]);
+#else
+    uintptr_t pc = 0;
+    uintptr_t fp = 0;
+#endif
+
+    Sample& sample = session->samples[slot];
+    int depth = 0;
+    if (pc) {
+        sample.frames[depth++] = pc;
+    }
+
+    // Frame record: [saved frame pointer, return address]; stacks grow down,
+    // so each caller's record must sit above its callee's
+    while (depth < kMaxFrames && fp && (fp % sizeof(uintptr_t)) == 0) {
+        uintptr_t record[2];
+        if (!read_frame(session->pid, fp, record) || record[1] == 0) {
+            break;
+        }
+        sample.frames[depth++] = record[1];
+        if (record[0] <= fp) {
+            break;
+        }
+        fp = record[0];
+    }
+
+    sample.depth.store(depth, std::memory_order_release);
+}
+
+// Installs on_sigprof once for the life of the process
+bool install_handler(std::string& err) {
+    static std::once_flag once;
+    static int installErrno = 0;
+    std::call_once(once, [] {
+        struct sigaction action {};
+        action.sa_sigaction = on_sigprof;
+        action.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGPROF, &action, nullptr) != 0) {
+            installErrno = errno;
+        }
+    });
+    if (installErrno != 0) {
+        err = std::string("sigaction failed: ") + std::strerror(installErrno);
+        return false;
+    }
+    return true;
+}
+
+struct Symbol {
+    uintptr_t start;
+    uintptr_t end;
+    std::string name;
+};
+
+std::string demangle(const char* name) {
+    int status = 0;
+    char* out = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+    if (status != 0 || !out) {
+        return name;
+    }
+    std::string result = out;
+    std::free(out);
+    return result;
+}
+
+int find_main_bias(dl_phdr_info* info, size_t, void* data) {
+    // The first object reported is the executable itself
+    *static_cast<uintptr_t*>(data) = static_cast<uintptr_t>(info->dlpi_addr);
+    return 1;
+}
+
+// Function symbols of the running executable (.symtab, else .dynsym), sorted by address
+std::vector<Symbol> load_executable_symbols() {
+    std::vector<Symbol> symbols;
+
+    std::ifstream file("/proc/self/exe", std::ios::binary);
+    std::vector<char> image((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (image.size() < sizeof(Elf64_Ehdr) || std::memcmp(image.data(), ELFMAG, SELFMAG) != 0) {
+        return symbols;
+    }
+
+    const auto* ehdr = reinterpret_cast<const Elf64_Ehdr*>(image.data());
+    if (ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+        ehdr->e_shoff + static_cast<size_t>(ehdr->e_shnum) * sizeof(Elf64_Shdr) > image.size()) {
+        return symbols;
+    }
+    const auto* sections = reinterpret_cast<const Elf64_Shdr*>(image.data() + ehdr->e_shoff);
+
+    uintptr_t bias = 0;
+    dl_iterate_phdr(find_main_bias, &bias);
+
+    for (Elf64_Word wanted : {SHT_SYMTAB, SHT_DYNSYM}) {
+        for (int i = 0; i < ehdr->e_shnum; ++i) {
+            const Elf64_Shdr& sec = sections[i];
+            if (sec.sh_type != wanted || sec.sh_link >= ehdr->e_shnum) continue;
+
+            const Elf64_Shdr& strtab = sections[sec.sh_link];
+            if (sec.sh_offset + sec.sh_size > image.size() ||
+                strtab.sh_offset + strtab.sh_size > image.size()) {
+                continue;
+            }
+
+            const auto* syms = reinterpret_cast<const Elf64_Sym*>(image.data() + sec.sh_offset);
+            size_t count = sec.sh_size / sizeof(Elf64_Sym);
+            for (size_t k = 0; k < count; ++k) {
+                const Elf64_Sym& sym = syms[k];
+                if (ELF64_ST_TYPE(sym.st_info) != STT_FUNC || sym.st_value == 0 ||
+                    sym.st_name >= strtab.sh_size) {
+                    continue;
+                }
+                const char* name = image.data() + strtab.sh_offset + sym.st_name;
+                uintptr_t start = bias + sym.st_value;
+                symbols.push_back({start, start + std::max<uintptr_t>(sym.st_size, 1), demangle(name)});
+            }
+        }
+        if (!symbols.empty()) break;    // .symtab is a superset of .dynsym
+    }
+
+    std::sort(symbols.begin(), symbols.end(),
+              [](const Symbol& a, const Symbol& b) { return a.start < b.start; });
+    return symbols;
+}
+
+class Symbolizer {
+public:
+    Symbolizer() : executable_(load_executable_symbols()) {}
+
+    const std::string& name(uintptr_t pc) {
+        auto cached = cache_.find(pc);
+        if (cached != cache_.end()) {
+            return cached->second;
+        }
+        // ';' separates frames in the collapsed format
+        std::string resolved = resolve(pc);
+        std::replace(resolved.begin(), resolved.end(), ';', ':');
+        return cache_[pc] = resolved;
+    }
+
+private:
+    std::string resolve(uintptr_t pc) {
+        auto it = std::upper_bound(executable_.begin(), executable_.end(), pc,
+                                   [](uintptr_t value, const Symbol& s) { return value < s.start; });
+        if (it != executable_.begin() && pc < std::prev(it)->end) {
+            return std::prev(it)->name;
+        }
+
+        Dl_info info;
+        if (dladdr(reinterpret_cast<void*>(pc), &info) && info.dli_fname) {
+            std::string module = info.dli_fname;
+            module = module.substr(module.find_last_of('/') + 1);
+            if (info.dli_sname) {
+                return demangle(info.dli_sname) + " [" + module + "]";
+            }
+            char offset[32];
+            std::snprintf(offset, sizeof(offset), "+0x%zx",
+                          static_cast<size_t>(pc - reinterpret_cast<uintptr_t>(info.dli_fbase)));
+            return module + offset;
+        }
+
+        char raw[32];
+        std::snprintf(raw, sizeof(raw), "0x%zx", static_cast<size_t>(pc));
+        return raw;
+    }
+
+    std::vector<Symbol> executable_;
+    std::map<uintptr_t, std::string> cache_;
+};
+
+} // namespace
+
+Profiler::Outcome Profiler::collect(int seconds, int hz, std::string& collapsed, std::string& err) {
+#if !defined(__x86_64__) && !defined(__aarch64__)
+    err = "Profiler is not supported on this architecture";
+    return Outcome::Failed;
+#endif
+    if (hz < 1 || hz > 1000000) {
+        err = "hz must be between 1 and 1000000";
+        return Outcome::Failed;
+    }
+    if (gRunning.exchange(true)) {
+        err = "A profile is already running";
+        return Outcome::Busy;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(gWaitMutex);
+        if (gShutdown) {
+            err = "Shutting down";
+            gRunning.store(false);
+            return Outcome::ShuttingDown;
+        }
+    }
+    if (!install_handler(err)) {
+        gRunning.store(false);
+        return Outcome::Failed;
+    }
+
+    auto session = std::make_unique<Session>();
+    gSession.store(session.get(), std::memory_order_seq_cst);
+
+    // tv_usec must stay below 1000000, so hz=1 is a whole second
+    long intervalUs = 1000000L / hz;
+    itimerval timer {};
+    timer.it_interval.tv_sec = intervalUs / 1000000;
+    timer.it_interval.tv_usec = intervalUs % 1000000;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+        err = std::string("setitimer failed: ") + std::strerror(errno);
+        gSession.store(nullptr, std::memory_order_seq_cst);
+        gRunning.store(false);
+        return Outcome::Failed;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(gWaitMutex);
+        gWaitCv.wait_for(lock, std::chrono::seconds(seconds), [] { return gShutdown; });
+    }
+
+    itimerval off {};
+    setitimer(ITIMER_PROF, &off, nullptr);
+    gSession.store(nullptr, std::memory_order_seq_cst);
+
+    // Wait out handlers that loaded the session before it was cleared
+    while (gInHandler.load(std::memory_order_seq_cst) != 0) {
+        std::this_thread::yield();
+    }
+
+    size_t taken = std::min(session->next.load(), kMaxSamples);
+    size_t dropped = session->next.load() - taken;
+
+    // Fold identical stacks (root first) into counts
+    Symbolizer symbols;
+    std::map<std::string, size_t> folded;
+    for (size_t i = 0; i < taken; ++i) {
+        const Sample& sample = session->samples[i];
+        int depth = sample.depth.load(std::memory_order_acquire);
+        if (depth == 0) continue;
+
+        std::string stack;
+        for (int f = depth - 1; f >= 0; --f) {
+            // Return addresses point after the call; step back into it
+            uintptr_t pc = (f == 0) ? sample.frames[f] : sample.frames[f] - 1;
+            if (!stack.empty()) stack += ';';
+            stack += symbols.name(pc);
+        }
+        folded[stack]++;
+    }
+
+    collapsed.clear();
+    for (const auto& kv : folded) {
+        collapsed += kv.first + " " + std::to_string(kv.second) + "\n";
+    }
+    if (dropped > 0) {
+        collapsed += "[dropped] " + std::to_string(dropped) + "\n";
+    }
+
+    gRunning.store(false);
+    return Outcome::Ok;
+}
+
+void Profiler::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(gWaitMutex);
+        gShutdown = true;
+    }
+    gWaitCv.notify_all();
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <string>
+
+// In-process sampling CPU profiler. While a profile runs, ITIMER_PROF raises
+// SIGPROF at `hz` per second of process CPU time; the handler records the
+// interrupted thread's stack by following frame pointers (reads go through
+// process_vm_readv, so a bogus frame pointer ends the walk instead of
+// crashing). Stacks are symbolized afterwards from the executable's symbol
+// table and dladdr for shared libraries, then folded into the "collapsed"
+// format that flamegraph.pl and speedscope read: "root;...;leaf count".
+//
+// The SIGPROF handler is installed on first use and left in place: a signal
+// still pending from the last timer tick must never meet SIG_DFL, which
+// terminates the process. Between profiles the handler returns immediately.
+//
+// Stacks through code built without frame pointers are cut short; build
+// with PROFILE=frame-pointers (see Dockerfile) for complete stacks.
+class Profiler {
+public:
+    enum class Outcome {
+        Ok,
+        Busy,           // another profile is already running
+        ShuttingDown,   // shutdown() was called
+        Failed          // unsupported platform or a failed system call; see err
+    };
+
+    // Blocks for `seconds`; `hz` must be between 1 and 1000000
+    static Outcome collect(int seconds, int hz, std::string& collapsed, std::string& err);
+
+    // Ends a running profile early (it still returns what it sampled) and
+    // makes later collect() calls fail; for process shutdown
+    static void shutdown();
+};
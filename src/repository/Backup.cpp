@@ -0,0 +1,402 @@
+#include "Backup.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Pages copied per sqlite3_backup_step call, and the pause between calls
+static const int kPagesPerStep = 64;
+static const std::chrono::milliseconds kStepPause(5);
+
+static const char* kSnapshotSuffix = ".db.gz";
+
+static std::string utc_timestamp(const char* format) {
+    std::time_t now = std::time(nullptr);
+    std::tm tm{};
+    gmtime_r(&now, &tm);
+
+    char buf[32];
+    std::strftime(buf, sizeof(buf), format, &tm);
+    return buf;
+}
+
+// Millisecond UTC stamp for snapshot names, e.g. 20240101-120000-042; names still sort chronologically
+static std::string snapshot_stamp() {
+    auto now = std::chrono::system_clock::now();
+    std::time_t seconds = std::chrono::system_clock::to_time_t(now);
+    long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000;
+
+    std::tm tm{};
+    gmtime_r(&seconds, &tm);
+
+    char buf[32];
+    std::size_t n = std::strftime(buf, sizeof(buf), "%Y%m%d-%H%M%S", &tm);
+    std::snprintf(buf + n, sizeof(buf) - n, "-%03lld", ms);
+    return buf;
+}
+
+static bool ends_with(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() &&
+           s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static bool gzip_file(const std::string& from, const std::string& to, std::string& err) {
+    std::ifstream in(from, std::ios::binary);
+    if (!in) {
+        err = "Cannot read " + from;
+        return false;
+    }
+
+    gzFile out = gzopen(to.c_str(), "wb6");
+    if (!out) {
+        err = "Cannot write " + to;
+        return false;
+    }
+
+    std::vector<char> buf(1 << 16);
+    while (in) {
+        in.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+        std::streamsize n = in.gcount();
+        if (n > 0 && gzwrite(out, buf.data(), static_cast<unsigned>(n)) != n) {
+            gzclose(out);
+            err = "Failed to compress snapshot";
+            return false;
+        }
+    }
+
+    if (gzclose(out) != Z_OK) {
+        err = "Failed to finish compressed snapshot";
+        return false;
+    }
+    return true;
+}
+
+// gzread also passes plain (uncompressed) files through unchanged
+static bool gunzip_file(const std::string& from, const std::string& to, std::string& err) {
+    gzFile in = gzopen(from.c_str(), "rb");
+    if (!in) {
+        err = "Cannot read " + from;
+        return false;
+    }
+
+    std::ofstream out(to, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        gzclose(in);
+        err = "Cannot write " + to;
+        return false;
+    }
+
+    std::vector<char> buf(1 << 16);
+    int n;
+    while ((n = gzread(in, buf.data(), static_cast<unsigned>(buf.size()))) > 0) {
+        out.write(buf.data(), n);
+    }
+    gzclose(in);
+
+    if (n < 0 || !out) {
+        err = "Failed to decompress " + from;
+        return false;
+    }
+    return true;
+}
+
+// Snapshot name prefix for a database file: its stem plus a dash
+static std::string snapshot_prefix(const std::string& dbPath) {
+    return fs::path(dbPath).stem().string() + "-";
+}
+
+// Every set in `backupDir`, keyed (and so sorted oldest first) by set id, with
+// one path per entry of dbPaths; "" where that file is missing from the set
+static std::map<std::string, std::vector<std::string>> list_sets(const std::string& backupDir,
+                                                                 const std::vector<std::string>& dbPaths) {
+    std::vector<std::string> prefixes;
+    for (const std::string& path : dbPaths) {
+        prefixes.push_back(snapshot_prefix(path));
+    }
+
+    std::map<std::string, std::vector<std::string>> sets;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(backupDir, ec)) {
+        std::string name = entry.path().filename().string();
+        if (!ends_with(name, kSnapshotSuffix)) continue;
+
+        for (size_t i = 0; i < prefixes.size(); ++i) {
+            if (name.rfind(prefixes[i], 0) != 0) continue;
+
+            std::string setId = name.substr(prefixes[i].size(),
+                                            name.size() - prefixes[i].size() - std::strlen(kSnapshotSuffix));
+            if (setId.empty() || setId.find_first_not_of("0123456789-") != std::string::npos) continue;
+
+            auto& files = sets[setId];
+            files.resize(dbPaths.size());
+            files[i] = entry.path().string();
+        }
+    }
+    return sets;
+}
+
+static bool is_complete(const std::vector<std::string>& files) {
+    return std::none_of(files.begin(), files.end(), [](const std::string& f) { return f.empty(); });
+}
+
+BackupManager::BackupManager(std::vector<sqlite3*> dbs, std::vector<std::string> dbPaths, std::string backupDir,
+                             int keep, std::chrono::minutes interval)
+    : dbs_(std::move(dbs)),
+      dbPaths_(std::move(dbPaths)),
+      backupDir_(std::move(backupDir)),
+      keep_(keep < 1 ? 1 : keep),
+      interval_(interval),
+      worker_(&BackupManager::worker_loop, this) {}
+
+BackupManager::~BackupManager() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    worker_.join();
+}
+
+bool BackupManager::trigger() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pending_ || status_.running) {
+            return false;
+        }
+        pending_ = true;
+    }
+    cv_.notify_all();
+    return true;
+}
+
+BackupStatus BackupManager::status() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return status_;
+}
+
+void BackupManager::worker_loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto nextScheduled = std::chrono::steady_clock::now() + interval_;
+
+    while (!stopping_) {
+        if (interval_.count() > 0) {
+            cv_.wait_until(lock, nextScheduled, [this] { return pending_ || stopping_; });
+            if (!pending_ && std::chrono::steady_clock::now() >= nextScheduled) {
+                pending_ = true;
+            }
+        } else {
+            cv_.wait(lock, [this] { return pending_ || stopping_; });
+        }
+
+        if (stopping_ || !pending_) continue;
+
+        pending_ = false;
+        status_.running = true;
+        lock.unlock();
+
+        auto started = std::chrono::steady_clock::now();
+        std::string setId, err;
+        std::vector<std::string> files;
+        int pages = 0;
+        bool ok = run_backup(setId, files, pages, err);
+        if (ok) {
+            prune();
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - started).count();
+
+        if (ok) {
+            std::cout << "Backup set " << setId << " written: " << files.size() << " files ("
+                      << pages << " pages, " << elapsed << "ms)" << std::endl;
+        } else {
+            std::cerr << "Backup failed: " << err << std::endl;
+        }
+
+        lock.lock();
+        status_.running = false;
+        status_.lastDurationMs = elapsed;
+        status_.lastFinishedAt = utc_timestamp("%Y-%m-%d %H:%M:%S");
+        status_.lastError = ok ? "" : err;
+        if (ok) {
+            status_.completed++;
+            status_.lastSet = setId;
+            status_.lastFiles = std::move(files);
+            status_.lastPages = pages;
+        }
+        nextScheduled = std::chrono::steady_clock::now() + interval_;
+    }
+}
+
+bool BackupManager::run_backup(std::string& setId, std::vector<std::string>& files, int& pages,
+                               std::string& err) {
+    std::error_code ec;
+    fs::create_directories(backupDir_, ec);
+    if (ec) {
+        err = "Cannot create " + backupDir_ + ": " + ec.message();
+        return false;
+    }
+
+    // The sequence number keeps two backups within the same millisecond apart
+    char sequence[16];
+    std::snprintf(sequence, sizeof(sequence), "-%04d", sequence_++ % 10000);
+    setId = snapshot_stamp() + sequence;
+
+    // Every file of the set, or none of it: a partial set is removed here, and
+    // one left by a crash is skipped by restores and removed by prune()
+    for (size_t i = 0; i < dbs_.size(); ++i) {
+        std::string file = (fs::path(backupDir_) / (snapshot_prefix(dbPaths_[i]) + setId + kSnapshotSuffix)).string();
+        int filePages = 0;
+        if (!copy_database(dbs_[i], file, filePages, err)) {
+            err = dbPaths_[i] + ": " + err;
+            for (const std::string& written : files) {
+                fs::remove(written, ec);
+            }
+            files.clear();
+            return false;
+        }
+        files.push_back(file);
+        pages += filePages;
+    }
+    return true;
+}
+
+bool BackupManager::copy_database(sqlite3* db, const std::string& file, int& pages, std::string& err) {
+    std::error_code ec;
+    std::string rawPath = file.substr(0, file.size() - std::strlen(kSnapshotSuffix)) + ".db.tmp";
+
+    sqlite3* dest = nullptr;
+    if (sqlite3_open(rawPath.c_str(), &dest) != SQLITE_OK) {
+        err = std::string("Cannot open backup file: ") + sqlite3_errmsg(dest);
+        sqlite3_close(dest);
+        return false;
+    }
+
+    // Using the serving connection as the source means its own writes are
+    // folded into the running backup instead of forcing a restart
+    sqlite3_backup* backup = sqlite3_backup_init(dest, "main", db, "main");
+    if (!backup) {
+        err = std::string("Cannot start backup: ") + sqlite3_errmsg(dest);
+        sqlite3_close(dest);
+        fs::remove(rawPath, ec);
+        return false;
+    }
+
+    int rc;
+    do {
+        rc = sqlite3_backup_step(backup, kPagesPerStep);
+        if (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+            std::this_thread::sleep_for(kStepPause);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) break;
+    } while (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED);
+
+    pages = sqlite3_backup_pagecount(backup);
+    sqlite3_backup_finish(backup);
+    int destRc = sqlite3_errcode(dest);
+    sqlite3_close(dest);
+
+    if (rc != SQLITE_DONE || destRc != SQLITE_OK) {
+        err = (rc == SQLITE_DONE) ? "Backup did not complete" : sqlite3_errstr(rc);
+        fs::remove(rawPath, ec);
+        return false;
+    }
+
+    std::string gzTmp = file + ".tmp";
+    bool ok = gzip_file(rawPath, gzTmp, err);
+    fs::remove(rawPath, ec);
+    if (!ok) {
+        fs::remove(gzTmp, ec);
+        return false;
+    }
+
+    fs::rename(gzTmp, file, ec);
+    if (ec) {
+        err = "Cannot finalize snapshot: " + ec.message();
+        fs::remove(gzTmp, ec);
+        return false;
+    }
+    return true;
+}
+
+// Keeps the newest `keep` complete sets and removes everything else,
+// including partial sets
+void BackupManager::prune() {
+    auto sets = list_sets(backupDir_, dbPaths_);
+
+    int kept = 0;
+    std::error_code ec;
+    for (auto it = sets.rbegin(); it != sets.rend(); ++it) {
+        if (is_complete(it->second) && kept < keep_) {
+            ++kept;
+            continue;
+        }
+        for (const std::string& file : it->second) {
+            if (!file.empty()) {
+                fs::remove(file, ec);
+            }
+        }
+    }
+}
+
+std::vector<std::string> BackupManager::latest_set(const std::string& backupDir,
+                                                   const std::vector<std::string>& dbPaths, std::string& err) {
+    auto sets = list_sets(backupDir, dbPaths);
+    for (auto it = sets.rbegin(); it != sets.rend(); ++it) {
+        if (is_complete(it->second)) {
+            return it->second;
+        }
+    }
+    err = "no complete backup set in " + backupDir;
+    return {};
+}
+
+std::vector<std::string> BackupManager::find_set(const std::string& backupDir, const std::vector<std::string>& dbPaths,
+                                                 const std::string& setId, std::string& err) {
+    auto sets = list_sets(backupDir, dbPaths);
+    auto it = sets.find(setId);
+    if (it == sets.end()) {
+        err = "no backup set " + setId + " in " + backupDir;
+        return {};
+    }
+    for (size_t i = 0; i < dbPaths.size(); ++i) {
+        if (it->second[i].empty()) {
+            err = "backup set " + setId + " has no snapshot of " + dbPaths[i];
+            return {};
+        }
+    }
+    return it->second;
+}
+
+bool BackupManager::restore(const std::string& snapshot, const std::string& dbPath, std::string& err) {
+    std::string staging = dbPath + ".restore";
+    if (!gunzip_file(snapshot, staging, err)) {
+        std::error_code ec;
+        fs::remove(staging, ec);
+        return false;
+    }
+
+    // Stale journals belong to the database being replaced
+    std::error_code ec;
+    fs::remove(dbPath + "-journal", ec);
+    fs::remove(dbPath + "-wal", ec);
+    fs::remove(dbPath + "-shm", ec);
+
+    fs::rename(staging, dbPath, ec);
+    if (ec) {
+        err = "Cannot replace " + dbPath + ": " + ec.message();
+        return false;
+    }
+    return true;
+}
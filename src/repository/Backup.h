@@ -0,0 +1,80 @@
+#pragma once
+#include <sqlite3.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct BackupStatus {
+    bool running = false;
+    int completed = 0;
+    std::string lastSet;
+    std::vector<std::string> lastFiles;
+    std::string lastError;
+    std::string lastFinishedAt;
+    long long lastDurationMs = 0;
+    int lastPages = 0;
+};
+
+// Online backups of the live databases. Pages are copied with
+// sqlite3_backup_step in small batches on a background thread, pausing
+// between batches so request handlers keep getting the connection. Each
+// snapshot is gzip-compressed.
+//
+// All files (every shard plus the router) are copied in one run that forms
+// a set: their snapshots share a set id, "<stamp>-<sequence>", so a file is
+// named <db stem>-<set id>.db.gz. A set missing any file (failed or cut
+// short by a crash) is never restored, and only the newest `keep` complete
+// sets are retained.
+class BackupManager {
+public:
+    // dbs and dbPaths are parallel; interval of zero disables scheduled
+    // backups (manual trigger only)
+    BackupManager(std::vector<sqlite3*> dbs, std::vector<std::string> dbPaths, std::string backupDir,
+                  int keep, std::chrono::minutes interval);
+    ~BackupManager();
+
+    BackupManager(const BackupManager&) = delete;
+    BackupManager& operator=(const BackupManager&) = delete;
+
+    // Queues a backup; false if one is already queued or running
+    bool trigger();
+
+    BackupStatus status() const;
+
+    // Snapshots of the newest complete set in `backupDir`, parallel to
+    // dbPaths; empty (and err set) if there is none
+    static std::vector<std::string> latest_set(const std::string& backupDir,
+                                               const std::vector<std::string>& dbPaths, std::string& err);
+
+    // Snapshots of set `setId`, parallel to dbPaths; empty (and err set) if
+    // the set does not exist or is missing a file
+    static std::vector<std::string> find_set(const std::string& backupDir, const std::vector<std::string>& dbPaths,
+                                             const std::string& setId, std::string& err);
+
+    // Replaces the file at dbPath with a (gzip) snapshot; the database must not be open
+    static bool restore(const std::string& snapshot, const std::string& dbPath, std::string& err);
+
+private:
+    void worker_loop();
+    bool run_backup(std::string& setId, std::vector<std::string>& files, int& pages, std::string& err);
+    bool copy_database(sqlite3* db, const std::string& file, int& pages, std::string& err);
+    void prune();
+
+    std::vector<sqlite3*> dbs_;
+    std::vector<std::string> dbPaths_;
+    std::string backupDir_;
+    int keep_;
+    std::chrono::minutes interval_;
+    int sequence_ = 0;      // worker thread only
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    bool pending_ = false;
+    bool stopping_ = false;
+    BackupStatus status_;
+    std::thread worker_;
+};
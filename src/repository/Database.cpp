@@ -1,14 +1,81 @@
 #include "Database.h"
+#include "Backup.h"
 #include <iostream>
 
-sqlite3* Database::init(const std::string& dbPath) {
+// True if `table` already has a column named `column` (used for migrations)
+static bool column_exists(sqlite3* db, const std::string& table, const std::string& column) {
+    std::string sql = "PRAGMA table_info(" + table + ");";
+    sqlite3_stmt* stmt = nullptr;
+
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        return false;
+    }
+
+    bool found = false;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char* name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        if (name && column == name) {
+            found = true;
+            break;
+        }
+    }
+
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+static bool table_exists(sqlite3* db, const char* table) {
+    const char* sql = "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = ?;";
+    sqlite3_stmt* stmt = nullptr;
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return false;
+    }
+
+    sqlite3_bind_text(stmt, 1, table, -1, SQLITE_STATIC);
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+// Databases created before a column existed get it added in place
+static bool add_column_if_missing(sqlite3* db, const std::string& table,
+                                  const std::string& column, const std::string& definition) {
+    if (column_exists(db, table, column)) {
+        return true;
+    }
+
+    std::string sql = "ALTER TABLE " + table + " ADD COLUMN " + column + " " + definition + ";";
+    char* errMsg = nullptr;
+    if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errMsg) != SQLITE_OK) {
+        std::cerr << "Failed to add column " << table << "." << column << ": " << errMsg << std::endl;
+        sqlite3_free(errMsg);
+        return false;
+    }
+    return true;
+}
+
+sqlite3* Database::init(const std::string& dbPath, const std::string& restoreFrom) {
     sqlite3* db = nullptr;
 
+    if (!restoreFrom.empty()) {
+        std::string err;
+        if (!BackupManager::restore(restoreFrom, dbPath, err)) {
+            std::cerr << "Failed to restore database: " << err << std::endl;
+            return nullptr;
+        }
+        std::cout << "Restored database from " << restoreFrom << std::endl;
+    }
+
     if (sqlite3_open(dbPath.c_str(), &db) != SQLITE_OK) {
         std::cerr << "Failed to open database: " << sqlite3_errmsg(db) << std::endl;
         return nullptr;
     }
 
+    // Only takes effect on a new (empty) file; lets the maintenance scheduler
+    // return free pages with incremental_vacuum instead of a full VACUUM
+    sqlite3_exec(db, "PRAGMA auto_vacuum = INCREMENTAL;", nullptr, nullptr, nullptr);
+
     const char* schema = R"(
         CREATE TABLE IF NOT EXISTS users (
             id INTEGER PRIMARY KEY AUTOINCREMENT,
@@ -16,6 +83,7 @@ sqlite3* Database::init(const std::string& dbPath) {
             lastName TEXT NOT NULL,
             email TEXT NOT NULL UNIQUE,
             passwordHash TEXT NOT NULL,
+            version INTEGER NOT NULL DEFAULT 1,
             createdAt TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
             updatedAt TIMESTAMP DEFAULT CURRENT_TIMESTAMP
         );
@@ -26,10 +94,74 @@ sqlite3* Database::init(const std::string& dbPath) {
             type TEXT NOT NULL,
             status TEXT NOT NULL,
             balance REAL NOT NULL DEFAULT 0,
+            balanceCents INTEGER NOT NULL DEFAULT 0,
+            version INTEGER NOT NULL DEFAULT 1,
             createdAt TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
             updatedAt TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
             FOREIGN KEY (userId) REFERENCES users(id)
         );
+
+        CREATE INDEX IF NOT EXISTS idx_accounts_user ON accounts(userId, id);
+    )";
+
+    // Append-only ledger of signed balance deltas in integer cents. Inserting a
+    // row applies it to the account in the same statement, so a delta can never
+    // be lost between a read and a write. `balance` is kept as a REAL mirror.
+    const char* ledgerTable = R"(
+        CREATE TABLE IF NOT EXISTS transactions (
+            id INTEGER PRIMARY KEY AUTOINCREMENT,
+            accountId INTEGER NOT NULL,
+            amountCents INTEGER NOT NULL,
+            balanceAfterCents INTEGER NOT NULL,
+            description TEXT,
+            createdAt TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+            FOREIGN KEY (accountId) REFERENCES accounts(id)
+        );
+
+        CREATE INDEX IF NOT EXISTS idx_transactions_account ON transactions(accountId, id);
+    )";
+
+    const char* ledgerTriggers = R"(
+        CREATE TRIGGER IF NOT EXISTS transactions_apply AFTER INSERT ON transactions
+        BEGIN
+            UPDATE accounts
+            SET balanceCents = balanceCents + NEW.amountCents,
+                balance = (balanceCents + NEW.amountCents) / 100.0,
+                version = version + 1,
+                updatedAt = CURRENT_TIMESTAMP
+            WHERE id = NEW.accountId;
+        END;
+
+        CREATE TRIGGER IF NOT EXISTS transactions_no_update BEFORE UPDATE ON transactions
+        BEGIN SELECT RAISE(ABORT, 'transactions are append-only'); END;
+        CREATE TRIGGER IF NOT EXISTS transactions_no_delete BEFORE DELETE ON transactions
+        BEGIN SELECT RAISE(ABORT, 'transactions are append-only'); END;
+    )";
+
+    // Collection versions: bumped by triggers on every insert/update/delete so
+    // list endpoints can answer If-None-Match without reading the rows
+    const char* versioning = R"(
+        CREATE TABLE IF NOT EXISTS entity_versions (
+            entity TEXT PRIMARY KEY,
+            version INTEGER NOT NULL DEFAULT 0
+        );
+
+        INSERT OR IGNORE INTO entity_versions (entity, version) VALUES ('users', 0);
+        INSERT OR IGNORE INTO entity_versions (entity, version) VALUES ('accounts', 0);
+
+        CREATE TRIGGER IF NOT EXISTS users_version_insert AFTER INSERT ON users
+        BEGIN UPDATE entity_versions SET version = version + 1 WHERE entity = 'users'; END;
+        CREATE TRIGGER IF NOT EXISTS users_version_update AFTER UPDATE ON users
+        BEGIN UPDATE entity_versions SET version = version + 1 WHERE entity = 'users'; END;
+        CREATE TRIGGER IF NOT EXISTS users_version_delete AFTER DELETE ON users
+        BEGIN UPDATE entity_versions SET version = version + 1 WHERE entity = 'users'; END;
+
+        CREATE TRIGGER IF NOT EXISTS accounts_version_insert AFTER INSERT ON accounts
+        BEGIN UPDATE entity_versions SET version = version + 1 WHERE entity = 'accounts'; END;
+        CREATE TRIGGER IF NOT EXISTS accounts_version_update AFTER UPDATE ON accounts
+        BEGIN UPDATE entity_versions SET version = version + 1 WHERE entity = 'accounts'; END;
+        CREATE TRIGGER IF NOT EXISTS accounts_version_delete AFTER DELETE ON accounts
+        BEGIN UPDATE entity_versions SET version = version + 1 WHERE entity = 'accounts'; END;
     )";
 
     char* errMsg = nullptr;
@@ -40,6 +172,144 @@ sqlite3* Database::init(const std::string& dbPath) {
         return nullptr;
     }
 
+    // Older databases stored balances only as REAL and had no ledger. The new
+    // columns, the cents backfill and an opening ledger row per funded account
+    // are one transaction, so a crash cannot leave a half-migrated file; the
+    // rows go in before transactions_apply exists, which would add them again.
+    bool hadBalanceCents = column_exists(db, "accounts", "balanceCents");
+    bool hadLedger = table_exists(db, "transactions");
+
+    const char* backfill =
+        "UPDATE accounts SET balanceCents = CAST(ROUND(balance * 100) AS INTEGER);";
+    const char* openingRows =
+        "INSERT INTO transactions (accountId, amountCents, balanceAfterCents, description) "
+        "SELECT id, balanceCents, balanceCents, 'Opening balance' FROM accounts "
+        "WHERE balanceCents <> 0 ORDER BY id;";
+
+    auto run = [db](const char* sql, const char* what) {
+        char* msg = nullptr;
+        if (sqlite3_exec(db, sql, nullptr, nullptr, &msg) != SQLITE_OK) {
+            std::cerr << "Failed to " << what << ": " << msg << std::endl;
+            sqlite3_free(msg);
+            return false;
+        }
+        return true;
+    };
+
+    bool migrated =
+        run("BEGIN IMMEDIATE;", "start migration") &&
+        add_column_if_missing(db, "users", "version", "INTEGER NOT NULL DEFAULT 1") &&
+        add_column_if_missing(db, "accounts", "version", "INTEGER NOT NULL DEFAULT 1") &&
+        add_column_if_missing(db, "accounts", "balanceCents", "INTEGER NOT NULL DEFAULT 0") &&
+        (hadBalanceCents || run(backfill, "migrate balances")) &&
+        run(ledgerTable, "create transactions ledger") &&
+        (hadLedger || run(openingRows, "record opening balances")) &&
+        run(ledgerTriggers, "create ledger triggers") &&
+        run("COMMIT;", "commit migration");
+
+    if (!migrated) {
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_close(db);
+        return nullptr;
+    }
+
+    if (sqlite3_exec(db, versioning, nullptr, nullptr, &errMsg) != SQLITE_OK) {
+        std::cerr << "Failed to create version tracking: " << errMsg << std::endl;
+        sqlite3_free(errMsg);
+        sqlite3_close(db);
+        return nullptr;
+    }
+
     std::cout << "Database initialized successfully" << std::endl;
     return db;
 }
+
+sqlite3* Database::init_router(const std::string& dbPath, const std::string& restoreFrom) {
+    sqlite3* db = nullptr;
+
+    if (!restoreFrom.empty()) {
+        std::string err;
+        if (!BackupManager::restore(restoreFrom, dbPath, err)) {
+            std::cerr << "Failed to restore router: " << err << std::endl;
+            return nullptr;
+        }
+        std::cout << "Restored router from " << restoreFrom << std::endl;
+    }
+
+    if (sqlite3_open(dbPath.c_str(), &db) != SQLITE_OK) {
+        std::cerr << "Failed to open router: " << sqlite3_errmsg(db) << std::endl;
+        return nullptr;
+    }
+
+    // As in init(): only a new file takes it
+    sqlite3_exec(db, "PRAGMA auto_vacuum = INCREMENTAL;", nullptr, nullptr, nullptr);
+
+    const char* schema = R"(
+        CREATE TABLE IF NOT EXISTS user_routes (
+            id INTEGER PRIMARY KEY AUTOINCREMENT,
+            email TEXT NOT NULL UNIQUE
+        );
+
+        CREATE TABLE IF NOT EXISTS shard_meta (
+            key TEXT PRIMARY KEY,
+            value TEXT NOT NULL
+        );
+    )";
+
+    char* errMsg = nullptr;
+    if (sqlite3_exec(db, schema, nullptr, nullptr, &errMsg) != SQLITE_OK) {
+        std::cerr << "Failed to create router tables: " << errMsg << std::endl;
+        sqlite3_free(errMsg);
+        sqlite3_close(db);
+        return nullptr;
+    }
+
+    std::cout << "Router initialized successfully" << std::endl;
+    return db;
+}
+
+int Database::record_balance_adjustment(sqlite3* db, int accountId, long long targetCents,
+                                        const char* description, bool includeLocked) {
+    const char* sql = includeLocked
+        ? "INSERT INTO transactions (accountId, amountCents, balanceAfterCents, description) "
+          "SELECT id, ? - balanceCents, ?, ? FROM accounts WHERE id = ? AND balanceCents <> ?;"
+        : "INSERT INTO transactions (accountId, amountCents, balanceAfterCents, description) "
+          "SELECT id, ? - balanceCents, ?, ? FROM accounts WHERE id = ? AND balanceCents <> ? "
+          "AND status <> 'locked';";
+
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return SQLITE_ERROR;
+    }
+
+    sqlite3_bind_int64(stmt, 1, targetCents);
+    sqlite3_bind_int64(stmt, 2, targetCents);
+    sqlite3_bind_text(stmt, 3, description, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 4, accountId);
+    sqlite3_bind_int64(stmt, 5, targetCents);
+
+    int rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    return rc;
+}
+
+Transaction::Transaction(sqlite3* db)
+    : db_(db),
+      active_(sqlite3_exec(db, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr) == SQLITE_OK) {}
+
+Transaction::~Transaction() {
+    if (active_) {
+        sqlite3_exec(db_, "ROLLBACK;", nullptr, nullptr, nullptr);
+    }
+}
+
+bool Transaction::commit() {
+    if (!active_) {
+        return false;
+    }
+    if (sqlite3_exec(db_, "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        return false;   // still open; the destructor rolls it back
+    }
+    active_ = false;
+    return true;
+}
@@ -4,5 +4,38 @@
 
 class Database {
 public:
-    static sqlite3* init(const std::string& dbPath);
+    // restoreFrom: optional snapshot that replaces dbPath before it is opened
+    static sqlite3* init(const std::string& dbPath, const std::string& restoreFrom = "");
+
+    // Routing index for sharded mode: global user ids and unique emails
+    static sqlite3* init_router(const std::string& dbPath, const std::string& restoreFrom = "");
+
+    // Moves an account to an absolute balance through the ledger: the row records
+    // the difference and its trigger applies it, so the ledger still sums to the
+    // balance. SQLITE_DONE without a row when the balance already matches, or
+    // when the account is locked and includeLocked is false.
+    static int record_balance_adjustment(sqlite3* db, int accountId, long long targetCents,
+                                         const char* description, bool includeLocked);
+};
+
+// BEGIN IMMEDIATE for a write that spans several statements; rolled back on
+// destruction unless commit() succeeded. Connections are shared, so the
+// caller holds the shard's write lock (ShardSet::write_mutex) for the
+// transaction's whole life and no other thread's statements can join it.
+class Transaction {
+public:
+    explicit Transaction(sqlite3* db);
+    ~Transaction();
+
+    Transaction(const Transaction&) = delete;
+    Transaction& operator=(const Transaction&) = delete;
+
+    // false if BEGIN failed; the caller must not go on
+    bool active() const { return active_; }
+
+    bool commit();
+
+private:
+    sqlite3* db_;
+    bool active_;
 };
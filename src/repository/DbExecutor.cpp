@@ -0,0 +1,115 @@
+#include "DbExecutor.h"
+
+#include <algorithm>
+#include <iostream>
+
+DbExecutor::DbExecutor(size_t readThreads, size_t writeThreads, size_t maxDepth)
+    : maxDepth_(maxDepth) {
+    start(reads_, "read", readThreads);
+    start(writes_, "write", writeThreads);
+}
+
+DbExecutor::~DbExecutor() {
+    shutdown();
+}
+
+void DbExecutor::shutdown() {
+    stop(reads_);
+    stop(writes_);
+}
+
+void DbExecutor::start(Queue& q, const char* name, size_t threads) {
+    q.name = name;
+    for (size_t i = 0; i < std::max<size_t>(threads, 1); ++i) {
+        q.workers.emplace_back([this, &q] { work(q); });
+    }
+}
+
+// Idempotent: a second call finds no workers left to join
+void DbExecutor::stop(Queue& q) {
+    std::vector<std::thread> workers;
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.stopping = true;
+        workers.swap(q.workers);
+    }
+    q.cv.notify_all();
+    for (auto& t : workers) {
+        t.join();
+    }
+}
+
+bool DbExecutor::submit(Kind kind, std::function<void()> job) {
+    Queue& q = queue(kind);
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.stopping || (maxDepth_ > 0 && q.jobs.size() >= maxDepth_)) {
+            q.rejected++;
+            return false;
+        }
+
+        q.jobs.push_back({std::move(job), std::chrono::steady_clock::now()});
+        q.peakDepth = std::max(q.peakDepth, q.jobs.size());
+    }
+    q.cv.notify_one();
+    return true;
+}
+
+bool DbExecutor::accepting(Kind kind) const {
+    const Queue& q = queue(kind);
+    std::lock_guard<std::mutex> lock(q.mutex);
+    return !q.stopping && (maxDepth_ == 0 || q.jobs.size() < maxDepth_);
+}
+
+size_t DbExecutor::pending() const {
+    size_t total = 0;
+    for (const Queue* q : {&reads_, &writes_}) {
+        std::lock_guard<std::mutex> lock(q->mutex);
+        total += q->jobs.size() + q->running;
+    }
+    return total;
+}
+
+void DbExecutor::work(Queue& q) {
+    std::unique_lock<std::mutex> lock(q.mutex);
+    for (;;) {
+        q.cv.wait(lock, [&q] { return q.stopping || !q.jobs.empty(); });
+        if (q.jobs.empty()) {
+            return;     // stopping and drained
+        }
+
+        Job job = std::move(q.jobs.front());
+        q.jobs.pop_front();
+        q.running++;
+        q.totalWaitUs += static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - job.queuedAt).count());
+        lock.unlock();
+
+        try {
+            job.run();
+        } catch (const std::exception& e) {
+            std::cerr << "Unhandled exception in " << q.name << " job: " << e.what() << std::endl;
+        }
+
+        lock.lock();
+        q.running--;
+        q.completed++;
+    }
+}
+
+QueueStats DbExecutor::stats(Kind kind) const {
+    const Queue& q = queue(kind);
+    std::lock_guard<std::mutex> lock(q.mutex);
+
+    QueueStats st;
+    st.name = q.name;
+    st.threads = q.workers.size();
+    st.depth = q.jobs.size();
+    st.peakDepth = q.peakDepth;
+    st.running = q.running;
+    st.completed = q.completed;
+    st.rejected = q.rejected;
+    std::uint64_t started = q.completed + q.running;
+    st.avgWaitMs = started ? (q.totalWaitUs / 1000.0) / started : 0;
+    return st;
+}
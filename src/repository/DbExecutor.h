@@ -0,0 +1,85 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct QueueStats {
+    std::string name;
+    size_t threads = 0;
+    size_t depth = 0;           // queued, not yet started
+    size_t peakDepth = 0;
+    size_t running = 0;
+    std::uint64_t completed = 0;
+    std::uint64_t rejected = 0;
+    double avgWaitMs = 0;       // time from submit to start, over started jobs
+};
+
+// Runs database work off the HTTP I/O threads, so slow SQLite work never
+// holds up static files or /health. Reads and writes have their own queues,
+// bounded separately: a backlog of writes does not get reads rejected. Every
+// worker uses the same serialized connection per shard, so the queues do not
+// add parallelism beyond one statement per shard at a time.
+class DbExecutor {
+public:
+    enum class Kind { Read, Write };
+
+    // maxDepth: submit() refuses work once this many jobs are waiting in a queue
+    DbExecutor(size_t readThreads, size_t writeThreads, size_t maxDepth);
+    ~DbExecutor();      // shutdown()
+
+    // Refuses new jobs, runs everything already queued and joins the workers
+    void shutdown();
+
+    DbExecutor(const DbExecutor&) = delete;
+    DbExecutor& operator=(const DbExecutor&) = delete;
+
+    // false if the queue is full; the job is then not run
+    bool submit(Kind kind, std::function<void()> job);
+
+    QueueStats stats(Kind kind) const;
+
+    // Whether submit() would take a job right now (the queue is below its limit)
+    bool accepting(Kind kind) const;
+
+    // Jobs queued or running, reads and writes together
+    size_t pending() const;
+
+private:
+    struct Job {
+        std::function<void()> run;
+        std::chrono::steady_clock::time_point queuedAt;
+    };
+
+    struct Queue {
+        std::string name;
+        mutable std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<Job> jobs;
+        std::vector<std::thread> workers;
+        bool stopping = false;
+
+        size_t peakDepth = 0;
+        size_t running = 0;
+        std::uint64_t completed = 0;
+        std::uint64_t rejected = 0;
+        std::uint64_t totalWaitUs = 0;
+    };
+
+    void start(Queue& q, const char* name, size_t threads);
+    void work(Queue& q);
+    void stop(Queue& q);
+
+    Queue& queue(Kind kind) { return kind == Kind::Read ? reads_ : writes_; }
+    const Queue& queue(Kind kind) const { return kind == Kind::Read ? reads_ : writes_; }
+
+    const size_t maxDepth_;
+    Queue reads_;
+    Queue writes_;
+};
@@ -0,0 +1,84 @@
+#include "ExistenceIndex.h"
+
+#include <iostream>
+
+bool ExistenceIndex::test(const Bitmap& bits, long long id) {
+    if (id < 1) return false;
+
+    const Bitmap::Slot* word = bits.find(static_cast<std::size_t>(id) >> 6);
+    return word && (word->load(std::memory_order_acquire) >> (id & 63)) & 1;
+}
+
+// Returns true if the bit changed
+bool ExistenceIndex::set(Bitmap& bits, long long id, bool value) {
+    if (id < 1) return false;
+
+    Bitmap::Slot* word = bits.get(static_cast<std::size_t>(id) >> 6);
+    if (!word) return false;
+
+    std::uint64_t mask = std::uint64_t(1) << (id & 63);
+    std::uint64_t before = value ? word->fetch_or(mask, std::memory_order_acq_rel)
+                                 : word->fetch_and(~mask, std::memory_order_acq_rel);
+    return ((before & mask) != 0) != value;
+}
+
+bool ExistenceIndex::user_has_accounts(long long userId) const {
+    if (userId < 1) return false;
+
+    const Counters::Slot* count = accountsPerUser_.find(static_cast<std::size_t>(userId));
+    return count && count->load(std::memory_order_acquire) > 0;
+}
+
+void ExistenceIndex::add_user(long long userId) {
+    if (set(users_, userId, true)) {
+        userCount_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void ExistenceIndex::remove_user(long long userId) {
+    if (set(users_, userId, false)) {
+        userCount_.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+void ExistenceIndex::add_account(long long accountId, long long userId) {
+    if (!set(accounts_, accountId, true)) return;
+
+    accountCount_.fetch_add(1, std::memory_order_relaxed);
+    if (Counters::Slot* count = accountsPerUser_.get(static_cast<std::size_t>(userId))) {
+        count->fetch_add(1, std::memory_order_acq_rel);
+    }
+}
+
+void ExistenceIndex::remove_account(long long accountId, long long userId) {
+    if (!set(accounts_, accountId, false)) return;
+
+    accountCount_.fetch_sub(1, std::memory_order_relaxed);
+    if (Counters::Slot* count = accountsPerUser_.get(static_cast<std::size_t>(userId))) {
+        count->fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
+
+bool ExistenceIndex::load(sqlite3* db) {
+    sqlite3_stmt* stmt = nullptr;
+
+    if (sqlite3_prepare_v2(db, "SELECT id FROM users;", -1, &stmt, nullptr) != SQLITE_OK) {
+        std::cerr << "Failed to load user ids: " << sqlite3_errmsg(db) << std::endl;
+        return false;
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        add_user(sqlite3_column_int64(stmt, 0));
+    }
+    sqlite3_finalize(stmt);
+
+    if (sqlite3_prepare_v2(db, "SELECT id, userId FROM accounts;", -1, &stmt, nullptr) != SQLITE_OK) {
+        std::cerr << "Failed to load account ids: " << sqlite3_errmsg(db) << std::endl;
+        return false;
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        add_account(sqlite3_column_int64(stmt, 0), sqlite3_column_int64(stmt, 1));
+    }
+    sqlite3_finalize(stmt);
+
+    return true;
+}
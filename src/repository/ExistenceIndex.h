@@ -0,0 +1,93 @@
+#pragma once
+#include <sqlite3.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Lock-free array of atomics, indexed by id and allocated a page at a time
+// the first time an id in that page is written. Reads never allocate.
+template <typename T, std::size_t PageSize, std::size_t MaxPages>
+class PagedAtomicArray {
+public:
+    using Slot = std::atomic<T>;
+
+    PagedAtomicArray() : pages_(new std::atomic<Slot*>[MaxPages]()) {}
+
+    ~PagedAtomicArray() {
+        for (std::size_t p = 0; p < MaxPages; ++p) {
+            delete[] pages_[p].load(std::memory_order_relaxed);
+        }
+    }
+
+    PagedAtomicArray(const PagedAtomicArray&) = delete;
+    PagedAtomicArray& operator=(const PagedAtomicArray&) = delete;
+
+    static constexpr std::size_t capacity() { return PageSize * MaxPages; }
+
+    // nullptr if the slot was never written (it reads as zero)
+    const Slot* find(std::size_t index) const {
+        if (index >= capacity()) return nullptr;
+        Slot* page = pages_[index / PageSize].load(std::memory_order_acquire);
+        return page ? &page[index % PageSize] : nullptr;
+    }
+
+    // nullptr only if index is out of range
+    Slot* get(std::size_t index) {
+        if (index >= capacity()) return nullptr;
+
+        std::atomic<Slot*>& entry = pages_[index / PageSize];
+        Slot* page = entry.load(std::memory_order_acquire);
+        if (!page) {
+            // Value-initialized: every slot starts at zero
+            Slot* fresh = new Slot[PageSize]();
+            if (entry.compare_exchange_strong(page, fresh, std::memory_order_acq_rel)) {
+                page = fresh;
+            } else {
+                delete[] fresh;     // another writer won; `page` now holds its page
+            }
+        }
+        return &page[index % PageSize];
+    }
+
+private:
+    std::unique_ptr<std::atomic<Slot*>[]> pages_;
+};
+
+// In-process view of which user and account ids exist and how many accounts
+// each user owns. Loaded from every shard at startup and kept current by the
+// routes that insert or delete rows, so existence checks and 404s for
+// unknown ids never reach SQLite. Ids are positive 31-bit integers.
+class ExistenceIndex {
+public:
+    // Adds every user and account in `db` (call once per shard before serving)
+    bool load(sqlite3* db);
+
+    bool has_user(long long userId) const { return test(users_, userId); }
+    bool has_account(long long accountId) const { return test(accounts_, accountId); }
+    bool user_has_accounts(long long userId) const;
+
+    void add_user(long long userId);
+    void remove_user(long long userId);
+    void add_account(long long accountId, long long userId);
+    void remove_account(long long accountId, long long userId);
+
+    std::size_t user_count() const { return userCount_.load(std::memory_order_relaxed); }
+    std::size_t account_count() const { return accountCount_.load(std::memory_order_relaxed); }
+
+private:
+    // One bit per id: a page of 64Ki words covers 4Mi ids
+    using Bitmap = PagedAtomicArray<std::uint64_t, 1 << 16, 512>;
+    // Accounts per user id: pages of 64Ki counters
+    using Counters = PagedAtomicArray<std::uint32_t, 1 << 16, 32768>;
+
+    static bool test(const Bitmap& bits, long long id);
+    static bool set(Bitmap& bits, long long id, bool value);
+
+    Bitmap users_;
+    Bitmap accounts_;
+    Counters accountsPerUser_;
+    std::atomic<std::size_t> userCount_{0};
+    std::atomic<std::size_t> accountCount_{0};
+};
@@ -0,0 +1,81 @@
+#include "HealthProbe.h"
+
+HealthProbe::HealthProbe(std::vector<sqlite3*> dbs, std::function<bool(std::function<void()>)> submit,
+                         std::chrono::milliseconds interval)
+    : dbs_(std::move(dbs)),
+      submit_(std::move(submit)),
+      interval_(interval),
+      state_(std::make_shared<State>()),
+      worker_(&HealthProbe::loop, this) {}
+
+HealthProbe::~HealthProbe() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    worker_.join();
+}
+
+bool HealthProbe::check(std::chrono::milliseconds maxAge, std::string& reason) const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    if (!state_->haveResult) {
+        reason = "no database probe has finished yet";
+        return false;
+    }
+    if (!state_->ok) {
+        reason = state_->error;
+        return false;
+    }
+    auto age = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - state_->finishedAt);
+    if (age > maxAge) {
+        reason = "last database probe finished " + std::to_string(age.count()) + "ms ago";
+        return false;
+    }
+    return true;
+}
+
+void HealthProbe::loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        bool start = false;
+        {
+            std::lock_guard<std::mutex> stateLock(state_->mutex);
+            // A probe still queued or running is not doubled up; it just ages
+            if (!state_->inFlight) {
+                state_->inFlight = true;
+                start = true;
+            }
+        }
+
+        if (start) {
+            std::shared_ptr<State> state = state_;
+            std::vector<sqlite3*> dbs = dbs_;
+            bool queued = submit_([state, dbs] {
+                std::string error;
+                for (sqlite3* db : dbs) {
+                    char* msg = nullptr;
+                    if (sqlite3_exec(db, "SELECT 1;", nullptr, nullptr, &msg) != SQLITE_OK) {
+                        error = std::string("database probe failed: ") + (msg ? msg : sqlite3_errmsg(db));
+                        sqlite3_free(msg);
+                        break;
+                    }
+                }
+
+                std::lock_guard<std::mutex> stateLock(state->mutex);
+                state->inFlight = false;
+                state->haveResult = true;
+                state->ok = error.empty();
+                state->error = error;
+                state->finishedAt = std::chrono::steady_clock::now();
+            });
+            if (!queued) {
+                std::lock_guard<std::mutex> stateLock(state_->mutex);
+                state_->inFlight = false;
+            }
+        }
+
+        cv_.wait_for(lock, interval_, [this] { return stopping_; });
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <sqlite3.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Database health for GET /ready without touching SQLite on the caller's
+// thread. Every `interval` a background thread submits one job that runs
+// SELECT 1 on every connection; the job goes through `submit` (the executor's
+// read queue), so a wedged queue shows up as a probe that never finishes. The
+// latest outcome and its time are kept for check().
+class HealthProbe {
+public:
+    // submit returns false when the job was refused (queue full, shutting down)
+    HealthProbe(std::vector<sqlite3*> dbs, std::function<bool(std::function<void()>)> submit,
+                std::chrono::milliseconds interval);
+    ~HealthProbe();
+
+    HealthProbe(const HealthProbe&) = delete;
+    HealthProbe& operator=(const HealthProbe&) = delete;
+
+    // True if the latest probe succeeded no longer than maxAge ago; otherwise
+    // `reason` says why (no probe yet, failed, or stale)
+    bool check(std::chrono::milliseconds maxAge, std::string& reason) const;
+
+private:
+    // Shared with queued jobs, which may run after the probe is gone
+    struct State {
+        std::mutex mutex;
+        bool inFlight = false;
+        bool haveResult = false;
+        bool ok = false;
+        std::string error;
+        std::chrono::steady_clock::time_point finishedAt;
+    };
+
+    void loop();
+
+    std::vector<sqlite3*> dbs_;
+    std::function<bool(std::function<void()>)> submit_;
+    std::chrono::milliseconds interval_;
+    std::shared_ptr<State> state_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+    std::thread worker_;
+};
@@ -0,0 +1,226 @@
+#include "Maintenance.h"
+
+#include <algorithm>
+#include <ctime>
+#include <iostream>
+
+// How often the load is sampled, and the pause between vacuum steps
+static const std::chrono::milliseconds kPollInterval(250);
+static const std::chrono::milliseconds kStepPause(5);
+
+static std::string utc_now() {
+    std::time_t now = std::time(nullptr);
+    std::tm tm{};
+    gmtime_r(&now, &tm);
+
+    char buf[32];
+    std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    return buf;
+}
+
+static bool exec(sqlite3* db, const char* sql, std::string& err) {
+    char* msg = nullptr;
+    if (sqlite3_exec(db, sql, nullptr, nullptr, &msg) != SQLITE_OK) {
+        err = msg ? msg : "unknown error";
+        sqlite3_free(msg);
+        return false;
+    }
+    return true;
+}
+
+// First column of the first row, as text ("" if there is none)
+static std::string query_text(sqlite3* db, const char* sql) {
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return "";
+    }
+
+    std::string value;
+    if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_text(stmt, 0)) {
+        value = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+    }
+    sqlite3_finalize(stmt);
+
+    return value;
+}
+
+static long long query_int(sqlite3* db, const char* sql) {
+    std::string value = query_text(db, sql);
+    return value.empty() ? 0 : std::stoll(value);
+}
+
+MaintenanceScheduler::MaintenanceScheduler(std::vector<sqlite3*> dbs, std::vector<std::string> names,
+                                           Options options, std::function<int()> pendingJobs)
+    : dbs_(std::move(dbs)),
+      options_(options),
+      pendingJobs_(std::move(pendingJobs)) {
+    stats_.resize(dbs_.size());
+    for (size_t i = 0; i < stats_.size() && i < names.size(); ++i) {
+        stats_[i].database = names[i];
+    }
+    for (size_t i = 0; i < dbs_.size(); ++i) {
+        check_auto_vacuum(dbs_[i], stats_[i].database);
+    }
+    worker_ = std::thread(&MaintenanceScheduler::loop, this);
+}
+
+MaintenanceScheduler::~MaintenanceScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    worker_.join();
+}
+
+// Runs before the server takes requests, so a full VACUUM only delays startup
+void MaintenanceScheduler::check_auto_vacuum(sqlite3* db, const std::string& name) {
+    if (query_int(db, "PRAGMA auto_vacuum;") == 2) {
+        return;
+    }
+
+    if (!options_.convertAutoVacuum) {
+        std::cout << name << " was created without auto_vacuum=INCREMENTAL; incremental vacuum is off for it"
+                  << " (MAINTENANCE_CONVERT_AUTO_VACUUM=1 rebuilds it once at startup)" << std::endl;
+        return;
+    }
+
+    std::cout << "Converting " << name << " to auto_vacuum=INCREMENTAL (full VACUUM)" << std::endl;
+    auto started = std::chrono::steady_clock::now();
+    std::string err;
+    if (!exec(db, "PRAGMA auto_vacuum = INCREMENTAL; VACUUM;", err)) {
+        std::cerr << "Converting " << name << " failed: " << err << std::endl;
+        return;
+    }
+    std::cout << "Converted " << name << " in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - started).count()
+              << "ms" << std::endl;
+}
+
+void MaintenanceScheduler::trigger() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        triggered_ = true;
+    }
+    cv_.notify_all();
+}
+
+bool MaintenanceScheduler::stopping_now() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stopping_;
+}
+
+std::vector<MaintenanceStats> MaintenanceScheduler::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void MaintenanceScheduler::loop() {
+    auto now = std::chrono::steady_clock::now();
+    auto lastRun = now;
+    auto quietSince = now;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        cv_.wait_for(lock, kPollInterval, [this] { return stopping_; });
+        if (stopping_) break;
+
+        // A low-load window is idleWindow of consecutive samples at or under the limit
+        now = std::chrono::steady_clock::now();
+        if (busy()) {
+            quietSince = now;
+            continue;
+        }
+
+        bool due = triggered_ ||
+                   (options_.interval.count() > 0 && now - lastRun >= options_.interval);
+        if (!due || now - quietSince < options_.idleWindow) {
+            continue;
+        }
+
+        lock.unlock();
+        bool finished = run_all();
+        lock.lock();
+
+        // A deferred run stays due and resumes in the next quiet window
+        if (finished) {
+            triggered_ = false;
+            lastRun = std::chrono::steady_clock::now();
+        }
+        quietSince = std::chrono::steady_clock::now();
+    }
+}
+
+bool MaintenanceScheduler::run_all() {
+    for (size_t i = 0; i < dbs_.size(); ++i) {
+        MaintenanceStats st;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_[i].running = true;
+            st = stats_[i];
+        }
+
+        auto started = std::chrono::steady_clock::now();
+        bool finished = run_one(dbs_[i], st);
+        st.lastDurationMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - started).count();
+        st.lastRunAt = utc_now();
+        st.deferred = !finished;
+        st.running = false;
+        st.runs++;
+
+        if (!st.lastError.empty()) {
+            std::cerr << "Maintenance of " << st.database << " failed: " << st.lastError << std::endl;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_[i] = st;
+        }
+
+        if (!finished) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// One pass over one database; false if it stopped early because of load
+bool MaintenanceScheduler::run_one(sqlite3* db, MaintenanceStats& st) {
+    static const char* kAutoVacuum[] = {"none", "full", "incremental"};
+
+    st.lastError.clear();
+    st.pagesVacuumed = 0;
+    long long autoVacuum = query_int(db, "PRAGMA auto_vacuum;");
+    st.autoVacuum = (autoVacuum >= 0 && autoVacuum <= 2) ? kAutoVacuum[autoVacuum] : "unknown";
+
+    // Planner statistics: a full ANALYZE the first time, then the cheap
+    // PRAGMA optimize, which only re-analyzes tables that changed enough
+    if (query_text(db, "SELECT name FROM sqlite_master WHERE name = 'sqlite_stat1';").empty()) {
+        if (!exec(db, "ANALYZE;", st.lastError)) return true;
+        st.analyzed = true;
+    }
+    if (!exec(db, "PRAGMA optimize;", st.lastError)) return true;
+
+    // Return free pages in small steps, yielding as soon as requests arrive.
+    // Files not (yet) converted to auto_vacuum=INCREMENTAL are left alone.
+    if (autoVacuum == 2) {
+        std::string step = "PRAGMA incremental_vacuum(" + std::to_string(options_.vacuumPages) + ");";
+        for (;;) {
+            long long freePages = query_int(db, "PRAGMA freelist_count;");
+            if (freePages == 0) break;
+            if (busy() || stopping_now()) {
+                st.freelistPages = freePages;
+                return false;
+            }
+
+            if (!exec(db, step.c_str(), st.lastError)) return true;
+            st.pagesVacuumed += std::min<long long>(freePages, options_.vacuumPages);
+            std::this_thread::sleep_for(kStepPause);
+        }
+    }
+    st.freelistPages = query_int(db, "PRAGMA freelist_count;");
+
+    return true;
+}
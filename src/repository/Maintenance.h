@@ -0,0 +1,75 @@
+#pragma once
+#include <sqlite3.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct MaintenanceStats {
+    std::string database;
+    std::string autoVacuum;         // none | full | incremental
+    int runs = 0;
+    bool running = false;
+    bool deferred = false;          // last run stopped early because traffic came back
+    std::string lastRunAt;
+    long long lastDurationMs = 0;
+    bool analyzed = false;          // a full ANALYZE has run (first run without statistics)
+    long long pagesVacuumed = 0;    // by the last run
+    long long freelistPages = 0;    // after the last run
+    std::string lastError;
+};
+
+// Keeps the databases healthy without a stop-the-world VACUUM: gathers
+// planner statistics (ANALYZE once, then PRAGMA optimize), returns free
+// pages with incremental_vacuum a few pages at a time. Work only starts once
+// the server has been quiet (pending database jobs at or below idleRequests)
+// for idleWindow, and yields between steps as soon as traffic returns.
+//
+// Incremental vacuum needs auto_vacuum=INCREMENTAL, which SQLite only applies
+// to a new file or through a full VACUUM. Older files are reported at startup,
+// or rebuilt once there when convertAutoVacuum is set.
+class MaintenanceScheduler {
+public:
+    struct Options {
+        std::chrono::minutes interval{60};      // zero: only when triggered
+        int vacuumPages = 256;                  // pages per incremental_vacuum step
+        std::chrono::milliseconds idleWindow{2000};
+        int idleRequests = 0;
+        bool convertAutoVacuum = false;         // VACUUM older files into INCREMENTAL at startup
+    };
+
+    MaintenanceScheduler(std::vector<sqlite3*> dbs, std::vector<std::string> names,
+                         Options options, std::function<int()> pendingJobs);
+    ~MaintenanceScheduler();
+
+    MaintenanceScheduler(const MaintenanceScheduler&) = delete;
+    MaintenanceScheduler& operator=(const MaintenanceScheduler&) = delete;
+
+    // Runs at the next quiet window without waiting for the interval
+    void trigger();
+
+    std::vector<MaintenanceStats> stats() const;
+
+private:
+    void check_auto_vacuum(sqlite3* db, const std::string& name);
+    void loop();
+    bool busy() const { return pendingJobs_() > options_.idleRequests; }
+    bool stopping_now() const;
+    bool run_all();
+    bool run_one(sqlite3* db, MaintenanceStats& st);
+
+    const std::vector<sqlite3*> dbs_;
+    const Options options_;
+    const std::function<int()> pendingJobs_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<MaintenanceStats> stats_;
+    bool triggered_ = false;
+    bool stopping_ = false;
+    std::thread worker_;
+};
@@ -0,0 +1,386 @@
+#include "ShardSet.h"
+#include "Database.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+// murmur3 finalizer: sequential ids spread evenly over the shards
+static std::uint64_t mix_id(std::uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static std::string sibling_path(const std::string& dbPath, const std::string& suffix) {
+    fs::path p(dbPath);
+    return (p.parent_path() / (p.stem().string() + suffix + p.extension().string())).string();
+}
+
+// True if the SQLite file at `path` exists and any of `tables` has a row
+static bool has_rows(const std::string& path, const std::vector<const char*>& tables) {
+    std::error_code ec;
+    if (!fs::exists(path, ec)) {
+        return false;
+    }
+
+    sqlite3* db = nullptr;
+    if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        sqlite3_close(db);
+        return false;
+    }
+
+    bool found = false;
+    for (const char* table : tables) {
+        std::string sql = std::string("SELECT 1 FROM ") + table + " LIMIT 1;";
+        sqlite3_stmt* stmt = nullptr;
+        // A missing table simply fails to prepare
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
+            found = sqlite3_step(stmt) == SQLITE_ROW;
+            sqlite3_finalize(stmt);
+        }
+        if (found) break;
+    }
+
+    sqlite3_close(db);
+    return found;
+}
+
+// Refuses layouts that would hide existing data: switching SHARD_COUNT between
+// 1 and N opens a different set of files and leaves the old one unused
+static bool check_layout(const std::string& dbPath, int shardCount) {
+    std::error_code ec;
+    if (shardCount > 1) {
+        std::vector<std::string> paths = ShardSet::file_paths(dbPath, shardCount);
+        for (const std::string& path : paths) {
+            if (fs::exists(path, ec)) {
+                return true;    // the sharded layout is already in use
+            }
+        }
+        if (has_rows(dbPath, {"users", "accounts"})) {
+            std::cerr << dbPath << " has data but SHARD_COUNT=" << shardCount
+                      << " would start empty shard files next to it; migrating an existing"
+                      << " database into shards is not supported" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    std::string router = sibling_path(dbPath, ".router");
+    if (has_rows(router, {"user_routes"})) {
+        std::cerr << router << " shows the data is sharded; start with the SHARD_COUNT"
+                  << " it was created with instead of 1" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+ShardSet::~ShardSet() {
+    for (sqlite3* db : shards_) {
+        sqlite3_close(db);
+    }
+    if (router_) {
+        sqlite3_close(router_);
+    }
+}
+
+std::vector<std::string> ShardSet::file_paths(const std::string& dbPath, int shardCount) {
+    if (shardCount <= 1) {
+        return {dbPath};
+    }
+
+    std::vector<std::string> paths;
+    for (int i = 0; i < shardCount; ++i) {
+        paths.push_back(sibling_path(dbPath, ".shard" + std::to_string(i)));
+    }
+    paths.push_back(sibling_path(dbPath, ".router"));
+    return paths;
+}
+
+std::unique_ptr<ShardSet> ShardSet::open(const std::string& dbPath, int shardCount,
+                                         const std::vector<std::string>& restoreFrom) {
+    if (!check_layout(dbPath, shardCount)) {
+        return nullptr;
+    }
+
+    std::vector<std::string> paths = file_paths(dbPath, shardCount);
+    auto restore = [&](size_t i) { return i < restoreFrom.size() ? restoreFrom[i] : std::string(); };
+
+    std::unique_ptr<ShardSet> set(new ShardSet());
+    size_t count = shardCount <= 1 ? 1 : static_cast<size_t>(shardCount);
+
+    for (size_t i = 0; i < count; ++i) {
+        sqlite3* db = Database::init(paths[i], restore(i));
+        if (!db) {
+            return nullptr;
+        }
+        set->shards_.push_back(db);
+        set->writeMutexes_.emplace_back(new std::mutex());
+    }
+
+    if (count == 1) {
+        return set;
+    }
+
+    set->router_ = Database::init_router(paths.back(), restore(count));
+    if (!set->router_) {
+        return nullptr;
+    }
+
+    // Rows are placed by id % shardCount, so the count can never silently change
+    const char* sql = "INSERT OR IGNORE INTO shard_meta (key, value) VALUES ('shardCount', ?);";
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(set->router_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return nullptr;
+    }
+    sqlite3_bind_int(stmt, 1, shardCount);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+
+    sql = "SELECT value FROM shard_meta WHERE key = 'shardCount';";
+    if (sqlite3_prepare_v2(set->router_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return nullptr;
+    }
+    int stored = (sqlite3_step(stmt) == SQLITE_ROW) ? sqlite3_column_int(stmt, 0) : 0;
+    sqlite3_finalize(stmt);
+
+    if (stored != shardCount) {
+        std::cerr << "Router was created for " << stored << " shards, not " << shardCount
+                  << "; resharding is not supported" << std::endl;
+        return nullptr;
+    }
+
+    if (!set->reconcile_router()) {
+        return nullptr;
+    }
+
+    std::cout << "Sharded storage: " << shardCount << " shards" << std::endl;
+    return set;
+}
+
+bool ShardSet::reconcile_router() {
+    // Current email of every user, from the shards (the source of truth)
+    std::unordered_map<long long, std::string> emails;
+    long long maxUserId = 0;
+    for (sqlite3* db : shards_) {
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v2(db, "SELECT id, email FROM users;", -1, &stmt, nullptr) != SQLITE_OK) {
+            std::cerr << "Failed to read users: " << sqlite3_errmsg(db) << std::endl;
+            return false;
+        }
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            long long id = sqlite3_column_int64(stmt, 0);
+            emails[id] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+            maxUserId = std::max(maxUserId, id);
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    std::vector<long long> orphans;
+    std::unordered_map<long long, std::string> routed;
+    {
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v2(router_, "SELECT id, email FROM user_routes;", -1, &stmt, nullptr) != SQLITE_OK) {
+            std::cerr << "Failed to read router: " << sqlite3_errmsg(router_) << std::endl;
+            return false;
+        }
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            long long id = sqlite3_column_int64(stmt, 0);
+            if (emails.count(id) == 0) {
+                orphans.push_back(id);
+            } else {
+                routed[id] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+            }
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    // Users whose route is missing (e.g. a router restored from an older
+    // backup) or carries an old email
+    size_t missing = 0;
+    std::vector<long long> stale;
+    for (const auto& entry : emails) {
+        auto it = routed.find(entry.first);
+        if (it == routed.end()) {
+            ++missing;
+            stale.push_back(entry.first);
+        } else if (it->second != entry.second) {
+            stale.push_back(entry.first);
+        }
+    }
+
+    // One transaction: stale reservations go first so their emails are free,
+    // then every differing user gets its route back. The id sequence is raised
+    // past every shard user so reserve_user never hands out a used id.
+    bool ok = sqlite3_exec(router_, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr) == SQLITE_OK;
+    for (long long id : orphans) {
+        if (!ok) break;
+        release_user(id);
+    }
+
+    sqlite3_stmt* stmt = nullptr;
+    if (ok && !stale.empty()) {
+        ok = sqlite3_prepare_v2(router_, "INSERT OR REPLACE INTO user_routes (id, email) VALUES (?, ?);",
+                                -1, &stmt, nullptr) == SQLITE_OK;
+        for (size_t i = 0; ok && i < stale.size(); ++i) {
+            sqlite3_bind_int64(stmt, 1, stale[i]);
+            sqlite3_bind_text(stmt, 2, emails[stale[i]].c_str(), -1, SQLITE_TRANSIENT);
+            ok = sqlite3_step(stmt) == SQLITE_DONE;
+            sqlite3_reset(stmt);
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    // Every shard user now has a route, so the sequence row exists
+    if (ok && maxUserId > 0) {
+        ok = sqlite3_prepare_v2(router_,
+                                "UPDATE sqlite_sequence SET seq = ?1 WHERE name = 'user_routes' AND seq < ?1;",
+                                -1, &stmt, nullptr) == SQLITE_OK;
+        if (ok) {
+            sqlite3_bind_int64(stmt, 1, maxUserId);
+            ok = sqlite3_step(stmt) == SQLITE_DONE;
+            sqlite3_finalize(stmt);
+        }
+    }
+
+    if (!ok) {
+        std::cerr << "Failed to repair router: " << sqlite3_errmsg(router_) << std::endl;
+        sqlite3_exec(router_, "ROLLBACK;", nullptr, nullptr, nullptr);
+        return false;
+    }
+    if (sqlite3_exec(router_, "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        std::cerr << "Failed to repair router: " << sqlite3_errmsg(router_) << std::endl;
+        sqlite3_exec(router_, "ROLLBACK;", nullptr, nullptr, nullptr);
+        return false;
+    }
+
+    if (!orphans.empty() || !stale.empty()) {
+        std::cout << "Router repaired: " << orphans.size() << " stale reservations released, "
+                  << missing << " routes restored, " << (stale.size() - missing) << " emails resynced"
+                  << std::endl;
+    }
+    return true;
+}
+
+std::vector<sqlite3*> ShardSet::connections() const {
+    std::vector<sqlite3*> out = shards_;
+    if (router_) {
+        out.push_back(router_);
+    }
+    return out;
+}
+
+size_t ShardSet::shard_of_user(long long userId) const {
+    if (shards_.size() == 1) return 0;
+    return static_cast<size_t>(mix_id(static_cast<std::uint64_t>(userId)) % shards_.size());
+}
+
+size_t ShardSet::shard_of_account(long long accountId) const {
+    if (shards_.size() == 1 || accountId < 1) return 0;
+    return static_cast<size_t>((accountId - 1) % static_cast<long long>(shards_.size()));
+}
+
+long long ShardSet::next_account_id(size_t index) const {
+    // sqlite_sequence keeps the highest id ever used, so deleted ids are not reused
+    const char* sql = "SELECT seq FROM sqlite_sequence WHERE name = 'accounts';";
+    sqlite3_stmt* stmt = nullptr;
+
+    long long seq = 0;
+    if (sqlite3_prepare_v2(shards_[index], sql, -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            seq = sqlite3_column_int64(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    long long n = static_cast<long long>(shards_.size());
+    long long candidate = seq + 1;
+    long long residue = (candidate - 1) % n;
+    return candidate + (static_cast<long long>(index) - residue + n) % n;
+}
+
+int ShardSet::reserve_user(const std::string& email, long long& userId) {
+    const char* sql = "INSERT INTO user_routes (email) VALUES (?) RETURNING id;";
+    sqlite3_stmt* stmt = nullptr;
+
+    if (sqlite3_prepare_v2(router_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return SQLITE_ERROR;
+    }
+
+    sqlite3_bind_text(stmt, 1, email.c_str(), -1, SQLITE_TRANSIENT);
+
+    int rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW) {
+        userId = sqlite3_column_int64(stmt, 0);
+        rc = SQLITE_OK;
+    }
+    sqlite3_finalize(stmt);
+
+    return rc;
+}
+
+void ShardSet::release_user(long long userId) {
+    const char* sql = "DELETE FROM user_routes WHERE id = ?;";
+    sqlite3_stmt* stmt = nullptr;
+
+    if (sqlite3_prepare_v2(router_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return;
+    }
+
+    sqlite3_bind_int64(stmt, 1, userId);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+int ShardSet::update_user_email(long long userId, const std::string& email, std::string& previousEmail) {
+    sqlite3_stmt* stmt = nullptr;
+
+    const char* readSql = "SELECT email FROM user_routes WHERE id = ?;";
+    if (sqlite3_prepare_v2(router_, readSql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return SQLITE_ERROR;
+    }
+    sqlite3_bind_int64(stmt, 1, userId);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        previousEmail = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+    }
+    sqlite3_finalize(stmt);
+
+    const char* sql = "UPDATE user_routes SET email = ? WHERE id = ?;";
+    if (sqlite3_prepare_v2(router_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return SQLITE_ERROR;
+    }
+
+    sqlite3_bind_text(stmt, 1, email.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 2, userId);
+
+    int rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+
+    return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+long long ShardSet::user_id_for_email(const std::string& email) const {
+    const char* sql = "SELECT id FROM user_routes WHERE email = ?;";
+    sqlite3_stmt* stmt = nullptr;
+
+    if (sqlite3_prepare_v2(router_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return 0;
+    }
+
+    sqlite3_bind_text(stmt, 1, email.c_str(), -1, SQLITE_TRANSIENT);
+
+    long long userId = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        userId = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+
+    return userId;
+}
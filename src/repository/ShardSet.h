@@ -0,0 +1,79 @@
+#pragma once
+#include <sqlite3.h>
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Users and accounts spread over N SQLite files, each with a single writer.
+// A user lives on shard hash(userId) % N and its accounts live with it, so
+// per-user routes touch one file. Account ids are allocated so that
+// (accountId - 1) % N names the shard. In sharded mode a small router
+// database hands out user ids and keeps emails globally unique.
+//
+// With one shard this is exactly the classic single users.db layout.
+class ShardSet {
+public:
+    ~ShardSet();
+
+    ShardSet(const ShardSet&) = delete;
+    ShardSet& operator=(const ShardSet&) = delete;
+
+    // Files backing a layout: the shards in order, then the router (if sharded)
+    static std::vector<std::string> file_paths(const std::string& dbPath, int shardCount);
+
+    // restoreFrom is parallel to file_paths(); empty entries mean no restore.
+    // Fails rather than hide data when SHARD_COUNT no longer matches the files on disk.
+    static std::unique_ptr<ShardSet> open(const std::string& dbPath, int shardCount,
+                                          const std::vector<std::string>& restoreFrom);
+
+    size_t size() const { return shards_.size(); }
+    bool sharded() const { return shards_.size() > 1; }
+
+    sqlite3* shard(size_t index) const { return shards_[index]; }
+    sqlite3* router() const { return router_; }
+
+    // Every open connection, in file_paths() order
+    std::vector<sqlite3*> connections() const;
+
+    size_t shard_of_user(long long userId) const;
+    size_t shard_of_account(long long accountId) const;
+
+    sqlite3* for_user(long long userId) const { return shards_[shard_of_user(userId)]; }
+    sqlite3* for_account(long long accountId) const { return shards_[shard_of_account(accountId)]; }
+
+    // One writer per shard: every write to shard `index` runs under this lock,
+    // from its first read to its last write. That keeps read-then-write checks
+    // and account id allocation race-free, and lets a multi-statement write use
+    // a transaction on the shared connection without other threads' statements
+    // joining it.
+    std::mutex& write_mutex(size_t index) { return *writeMutexes_[index]; }
+
+    // Next unused account id that routes to `index`; hold write_mutex(index)
+    long long next_account_id(size_t index) const;
+
+    // ---- Router (sharded mode only) ----
+
+    // Claims a new global user id for `email`; SQLITE_CONSTRAINT if it is taken
+    int reserve_user(const std::string& email, long long& userId);
+    void release_user(long long userId);
+
+    // Moves a user to a new email; previousEmail allows undoing it
+    int update_user_email(long long userId, const std::string& email, std::string& previousEmail);
+
+    // 0 if no user has this email
+    long long user_id_for_email(const std::string& email) const;
+
+private:
+    ShardSet() = default;
+
+    // Router rows left behind by a crash between the router write and the
+    // shard write: reservations without a user are released, emails resynced
+    bool reconcile_router();
+
+    std::vector<sqlite3*> shards_;
+    std::vector<std::unique_ptr<std::mutex>> writeMutexes_;
+    sqlite3* router_ = nullptr;
+};
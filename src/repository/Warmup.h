@@ -0,0 +1,21 @@
+#pragma once
+#include <sqlite3.h>
+
+#include <string>
+
+struct WarmupStats {
+    long long fileBytes = 0;    // bytes read to prime the OS page cache
+    int btrees = 0;             // tables + indexes walked into SQLite's cache
+    long long durationMs = 0;
+    std::string error;
+};
+
+// Startup warm-up for one connection, run before the instance reports ready:
+// reads the database file once so the OS page cache is hot, optionally sizes
+// SQLite's page cache / mmap window, then walks every table and index b-tree
+// (which also loads and parses the schema on this connection).
+class Warmup {
+public:
+    // cacheMb / mmapMb: 0 keeps SQLite's defaults
+    static WarmupStats preload(sqlite3* db, const std::string& dbPath, long cacheMb, long mmapMb);
+};
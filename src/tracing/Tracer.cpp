@@ -0,0 +1,246 @@
+#include "Tracer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+namespace {
+
+thread_local RequestTrace* tCurrent = nullptr;
+
+// Small stable number per thread, used as the Chrome trace "tid"
+unsigned thread_number() {
+    static std::atomic<unsigned> next{1};
+    thread_local unsigned number = next.fetch_add(1);
+    return number;
+}
+
+struct PooledTrace {
+    RequestTrace trace;
+    std::atomic<bool> inUse{false};
+};
+
+// Rows of EXPLAIN QUERY PLAN, one "detail" per line, indented by depth
+std::string explain(sqlite3* db, std::string_view sql) {
+    std::string eqp = "EXPLAIN QUERY PLAN ";
+    eqp.append(sql.data(), sql.size());
+
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, eqp.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        return "      (no plan: " + std::string(sqlite3_errmsg(db)) + ")\n";
+    }
+
+    // Unbound parameters are NULL, which does not change the chosen plan
+    std::map<int, int> depth;
+    std::string out;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int id = sqlite3_column_int(stmt, 0);
+        int parent = sqlite3_column_int(stmt, 1);
+        const unsigned char* detail = sqlite3_column_text(stmt, 3);
+
+        depth[id] = (parent == 0) ? 0 : depth[parent] + 1;
+        out += "      " + std::string(2 * depth[id], ' ');
+        out += detail ? reinterpret_cast<const char*>(detail) : "";
+        out += "\n";
+    }
+    sqlite3_finalize(stmt);
+
+    return out;
+}
+
+} // namespace
+
+Tracer::Tracer(unsigned sampleEvery, size_t keep, long slowMs)
+    : sampleEvery_(sampleEvery), keep_(keep), slowMs_(slowMs) {
+    if (slowMs_ > 0) {
+        slowLogger_ = std::thread(&Tracer::slow_log_loop, this);
+    }
+}
+
+Tracer::~Tracer() {
+    {
+        std::lock_guard<std::mutex> lock(slowMutex_);
+        stopping_ = true;
+    }
+    slowCv_.notify_all();
+    if (slowLogger_.joinable()) {
+        slowLogger_.join();
+    }
+}
+
+std::uint64_t Tracer::now_us() {
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+RequestTrace* Tracer::current() {
+    return tCurrent;
+}
+
+void Tracer::skip_slow_log() {
+    if (tCurrent) {
+        tCurrent->slowLog = false;
+    }
+}
+
+TraceScope::TraceScope(RequestTrace* trace) : previous_(tCurrent) {
+    tCurrent = trace;
+}
+
+TraceScope::~TraceScope() {
+    tCurrent = previous_;
+}
+
+void Tracer::instrument(sqlite3* db) {
+    sqlite3_trace_v2(db, SQLITE_TRACE_PROFILE, &Tracer::on_statement, this);
+}
+
+// SQLITE_TRACE_PROFILE fires when a statement finishes, on the thread that ran it
+int Tracer::on_statement(unsigned type, void*, void* stmt, void* elapsedNs) {
+    RequestTrace* trace = tCurrent;
+    if (type != SQLITE_TRACE_PROFILE || !trace || trace->queries.size() >= RequestTrace::kMaxQueries) {
+        return 0;
+    }
+
+    auto* statement = static_cast<sqlite3_stmt*>(stmt);
+    const char* sql = sqlite3_sql(statement);
+    if (!sql) {
+        return 0;
+    }
+
+    std::uint64_t durUs = *static_cast<sqlite3_int64*>(elapsedNs) / 1000;
+    std::uint64_t endUs = now_us();
+
+    TracedQuery q;
+    q.db = sqlite3_db_handle(statement);
+    q.offset = trace->sqlText.size();
+    q.length = std::char_traits<char>::length(sql);
+    q.startUs = endUs > durUs ? endUs - durUs : endUs;
+    q.durUs = durUs;
+
+    trace->sqlText.append(sql, q.length);
+    trace->queries.push_back(q);
+    return 0;
+}
+
+RequestTrace* Tracer::begin(const char* method, const std::string& path) {
+    thread_local PooledTrace pooled;
+
+    RequestTrace* trace;
+    if (!pooled.inUse.exchange(true)) {
+        trace = &pooled.trace;
+        trace->pooledInUse = &pooled.inUse;
+    } else {
+        // The pooled trace is still lent to an unfinished async response
+        trace = new RequestTrace();
+    }
+
+    trace->name.assign(method);
+    trace->name += ' ';
+    trace->name += path;
+    trace->status = 0;
+    trace->sampled = sampleEvery_ > 0 &&
+                     requests_.fetch_add(1, std::memory_order_relaxed) % sampleEvery_ == 0;
+    trace->slowLog = true;
+    trace->thread = thread_number();
+    trace->spans.clear();
+    trace->queries.clear();
+    trace->sqlText.clear();
+    trace->startUs = now_us();
+    trace->durUs = 0;
+
+    tCurrent = trace;
+    return trace;
+}
+
+void Tracer::end(RequestTrace* trace, int status) {
+    if (!trace) return;
+
+    trace->durUs = now_us() - trace->startUs;
+    trace->status = status;
+
+    if (tCurrent == trace) {
+        tCurrent = nullptr;
+    }
+
+    if (slowMs_ > 0 && trace->slowLog && trace->durUs >= static_cast<std::uint64_t>(slowMs_) * 1000) {
+        // EXPLAIN runs on the slow-log thread; only a copy is queued here
+        std::lock_guard<std::mutex> lock(slowMutex_);
+        if (pendingSlow_.size() < kMaxPendingSlow) {
+            pendingSlow_.push_back(*trace);
+            pendingSlow_.back().pooledInUse = nullptr;
+            slowCv_.notify_one();
+        } else {
+            droppedSlow_++;
+        }
+    }
+
+    if (trace->sampled && keep_ > 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sampled_.push_front(*trace);
+        sampled_.front().pooledInUse = nullptr;
+        if (sampled_.size() > keep_) {
+            sampled_.pop_back();
+        }
+    }
+
+    if (trace->pooledInUse) {
+        trace->pooledInUse->store(false);
+    } else {
+        delete trace;
+    }
+}
+
+std::vector<RequestTrace> Tracer::recent(size_t limit) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t n = std::min(limit, sampled_.size());
+    return std::vector<RequestTrace>(sampled_.begin(), sampled_.begin() + n);
+}
+
+void Tracer::slow_log_loop() {
+    std::unique_lock<std::mutex> lock(slowMutex_);
+    for (;;) {
+        slowCv_.wait(lock, [this] { return stopping_ || !pendingSlow_.empty(); });
+        if (stopping_) break;
+
+        RequestTrace trace = std::move(pendingSlow_.front());
+        pendingSlow_.pop_front();
+        size_t dropped = droppedSlow_;
+        droppedSlow_ = 0;
+
+        lock.unlock();
+        if (dropped > 0) {
+            std::cout << "[slow] " << dropped << " slow requests not logged (queue full)" << std::endl;
+        }
+        log_slow(trace);
+        lock.lock();
+    }
+}
+
+// One block per slow request: each distinct statement once, with its plan.
+// This thread has no current trace, so the EXPLAIN statements are not recorded.
+void Tracer::log_slow(const RequestTrace& trace) const {
+    struct Stat {
+        sqlite3* db;
+        int count = 0;
+        std::uint64_t totalUs = 0;
+    };
+    std::map<std::string_view, Stat> stats;
+    for (const TracedQuery& q : trace.queries) {
+        Stat& st = stats.emplace(trace.sql(q), Stat{q.db}).first->second;
+        st.count++;
+        st.totalUs += q.durUs;
+    }
+
+    std::ostringstream out;
+    out << "[slow] " << trace.name << " " << trace.status << " "
+        << (trace.durUs / 1000) << "ms, " << trace.queries.size() << " statements\n";
+    for (const auto& kv : stats) {
+        out << "    " << (kv.second.totalUs / 1000.0) << "ms x" << kv.second.count
+            << "  " << kv.first << "\n"
+            << explain(kv.second.db, kv.first);
+    }
+    std::cout << out.str() << std::flush;
+}
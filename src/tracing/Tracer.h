@@ -0,0 +1,153 @@
+#pragma once
+#include <sqlite3.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// One timed phase of a request (a Chrome trace "complete" event)
+struct TraceSpan {
+    const char* name;           // string literal
+    std::uint64_t startUs;
+    std::uint64_t durUs;
+};
+
+// A statement run during the request, timed by SQLite's profile hook
+struct TracedQuery {
+    sqlite3* db;
+    size_t offset;              // text is RequestTrace::sqlText[offset, offset + length)
+    size_t length;
+    std::uint64_t startUs;
+    std::uint64_t durUs;
+};
+
+// Everything recorded for one request. Each worker thread reuses one of
+// these, so an unsampled request only copies its SQL text into warm buffers.
+struct RequestTrace {
+    static constexpr size_t kMaxQueries = 256;
+
+    std::string name;           // e.g. "GET /users"
+    int status = 0;
+    bool sampled = false;
+    bool slowLog = true;        // false for requests that wait by design (long-polls, profiles)
+    unsigned thread = 0;
+    std::uint64_t startUs = 0;
+    std::uint64_t durUs = 0;
+    std::vector<TraceSpan> spans;
+    std::vector<TracedQuery> queries;
+    std::string sqlText;        // unexpanded SQL: bound values are never recorded
+
+    std::string_view sql(const TracedQuery& q) const {
+        return std::string_view(sqlText).substr(q.offset, q.length);
+    }
+
+    std::atomic<bool>* pooledInUse = nullptr;   // set while a pooled trace is lent out
+};
+
+// Per-request tracing. Every TRACE_SAMPLE_EVERY-th request records its phases
+// (ScopedSpan) and SQL statements; the newest sampled traces are kept for
+// GET /debug/traces. Independently, any request slower than the slow
+// threshold logs its statements together with EXPLAIN QUERY PLAN output;
+// that runs on the Tracer's own thread, never on the one finishing the request.
+class Tracer {
+public:
+    // sampleEvery: 0 disables sampling; slowMs: 0 disables the slow-query log
+    Tracer(unsigned sampleEvery, size_t keep, long slowMs);
+    ~Tracer();
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    // Times every statement on `db`; call once per connection
+    void instrument(sqlite3* db);
+
+    // Starts recording on this thread; the trace stays owned by the Tracer
+    RequestTrace* begin(const char* method, const std::string& path);
+
+    // Finishes a trace from begin() (possibly on another thread)
+    void end(RequestTrace* trace, int status);
+
+    // Newest sampled traces first, at most `limit`
+    std::vector<RequestTrace> recent(size_t limit) const;
+
+    // Trace being recorded on this thread, or nullptr
+    static RequestTrace* current();
+
+    // Keeps the current request out of the slow-query log; for routes whose
+    // wall time is mostly waiting (long-polls, profiles), not work
+    static void skip_slow_log();
+
+    // Microseconds on a monotonic clock (trace timestamps)
+    static std::uint64_t now_us();
+
+private:
+    static constexpr size_t kMaxPendingSlow = 64;
+
+    static int on_statement(unsigned type, void* self, void* stmt, void* elapsedNs);
+    void log_slow(const RequestTrace& trace) const;
+    void slow_log_loop();
+
+    const unsigned sampleEvery_;
+    const size_t keep_;
+    const long slowMs_;
+    std::atomic<std::uint64_t> requests_{0};
+
+    mutable std::mutex mutex_;
+    std::deque<RequestTrace> sampled_;
+
+    // Slow requests waiting to be logged; beyond kMaxPendingSlow they are dropped
+    std::mutex slowMutex_;
+    std::condition_variable slowCv_;
+    std::deque<RequestTrace> pendingSlow_;
+    size_t droppedSlow_ = 0;
+    bool stopping_ = false;
+    std::thread slowLogger_;
+};
+
+// Makes `trace` current on this thread for the enclosing scope, for work
+// that a request hands to another thread
+class TraceScope {
+public:
+    explicit TraceScope(RequestTrace* trace);
+    ~TraceScope();
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    RequestTrace* previous_;
+};
+
+// Records the enclosing scope as a phase of the current request, if sampled
+class ScopedSpan {
+public:
+    explicit ScopedSpan(const char* name)
+        : trace_(Tracer::current()), name_(name) {
+        if (trace_ && trace_->sampled) {
+            start_ = Tracer::now_us();
+        } else {
+            trace_ = nullptr;
+        }
+    }
+
+    ~ScopedSpan() {
+        if (trace_) {
+            trace_->spans.push_back({name_, start_, Tracer::now_us() - start_});
+        }
+    }
+
+    ScopedSpan(const ScopedSpan&) = delete;
+    ScopedSpan& operator=(const ScopedSpan&) = delete;
+
+private:
+    RequestTrace* trace_;
+    const char* name_;
+    std::uint64_t start_ = 0;
+};
@@ -0,0 +1,90 @@
+// The request arena: allocations are counted, arenas are reused per thread,
+// large requests spill to the heap, and release works from any thread.
+#include "check.h"
+#include "memory/RequestArena.h"
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+static void test_allocations_are_counted_and_aligned() {
+    RequestArena* arena = RequestArena::acquire();
+    CHECK(arena->allocations() == 0 && arena->bytes() == 0);
+
+    void* a = arena->allocate(10, 1);
+    void* b = arena->allocate(64, 64);
+    CHECK(a != nullptr && b != nullptr);
+    CHECK(reinterpret_cast<std::uintptr_t>(b) % 64 == 0);
+    CHECK(arena->allocations() == 2);
+    CHECK(arena->bytes() == 74);
+
+    // Containers on the arena work as usual
+    std::pmr::vector<std::pmr::string> names(arena);
+    for (int i = 0; i < 100; ++i) {
+        names.emplace_back("a string long enough to need its own allocation #" + std::to_string(i));
+    }
+    CHECK(names.size() == 100 && names[99].back() == '9');
+
+    RequestArena::release(arena);
+}
+
+static void test_arenas_are_reused_and_rewound() {
+    RequestArena* first = RequestArena::acquire();
+    CHECK(first->allocate(128, 8) != nullptr);
+    RequestArena::release(first);
+
+    // Same thread: the freed arena comes back with its counters reset
+    RequestArena* again = RequestArena::acquire();
+    CHECK(again == first);
+    CHECK(again->allocations() == 0 && again->bytes() == 0);
+
+    // Overlapping requests get distinct arenas
+    RequestArena* other = RequestArena::acquire();
+    CHECK(other != again);
+
+    RequestArena::release(other);
+    RequestArena::release(again);
+    RequestArena::release(nullptr);     // no-op
+}
+
+static void test_large_requests_spill() {
+    RequestArena* arena = RequestArena::acquire();
+
+    // Past the inline buffer: served from the heap and freed on release
+    std::vector<void*> blocks;
+    for (int i = 0; i < 8; ++i) {
+        void* p = arena->allocate(RequestArena::kBufferSize, 16);
+        CHECK(p != nullptr);
+        static_cast<unsigned char*>(p)[RequestArena::kBufferSize - 1] = 1;
+        blocks.push_back(p);
+    }
+    CHECK(arena->bytes() == 8 * RequestArena::kBufferSize);
+
+    RequestArena::release(arena);
+    RequestArena* again = RequestArena::acquire();
+    CHECK(again->bytes() == 0);
+    RequestArena::release(again);
+}
+
+// Released on another thread (an async response completed by a worker), and
+// after the acquiring thread has exited
+static void test_release_from_other_threads() {
+    RequestArena* arena = RequestArena::acquire();
+    std::thread([arena] { RequestArena::release(arena); }).join();
+    CHECK(RequestArena::acquire() == arena);
+    RequestArena::release(arena);
+
+    RequestArena* orphan = nullptr;
+    std::thread([&orphan] { orphan = RequestArena::acquire(); }).join();
+    CHECK(orphan->allocate(32, 8) != nullptr);
+    RequestArena::release(orphan);      // owner is gone: simply freed
+}
+
+int main() {
+    test_allocations_are_counted_and_aligned();
+    test_arenas_are_reused_and_rewound();
+    test_large_requests_spill();
+    test_release_from_other_threads();
+    return finish("arena_test");
+}
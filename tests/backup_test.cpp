@@ -0,0 +1,131 @@
+// Backups: every file is copied into one numbered set, restores only take
+// complete sets, and retention counts sets rather than files.
+#include "check.h"
+#include "repository/Backup.h"
+#include "repository/Database.h"
+
+#include <chrono>
+#include <filesystem>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+// Runs one backup set and waits for it; false if it did not finish in time
+static bool backup_now(BackupManager& backups) {
+    int before = backups.status().completed;
+    if (!backups.trigger()) {
+        return false;
+    }
+    for (int i = 0; i < 500; ++i) {
+        BackupStatus st = backups.status();
+        if (!st.running && st.completed > before) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+static int count_snapshots(const std::string& dir) {
+    int n = 0;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(dir, ec)) {
+        (void)entry;
+        ++n;
+    }
+    return n;
+}
+
+static void test_sets_are_complete_and_restorable() {
+    TempDir dir("backup-sets");
+    std::vector<std::string> paths = {dir.file("users.shard0.db"), dir.file("users.shard1.db")};
+    std::string backupDir = dir.file("backups");
+
+    sqlite3* a = Database::init(paths[0]);
+    sqlite3* b = Database::init(paths[1]);
+    CHECK(a != nullptr && b != nullptr);
+    if (!a || !b) return;
+    CHECK(insert_user(a, 1, "a@example.com"));
+    CHECK(insert_user(b, 2, "b@example.com"));
+
+    std::string older;
+    std::string newer;
+    {
+        BackupManager backups({a, b}, paths, backupDir, 2, std::chrono::minutes(0));
+        CHECK(backup_now(backups));
+        older = backups.status().lastSet;
+        CHECK(backups.status().lastFiles.size() == 2);
+
+        CHECK(insert_user(a, 3, "c@example.com"));
+        CHECK(backup_now(backups));
+        newer = backups.status().lastSet;
+        CHECK(newer > older);
+    }
+
+    std::string err;
+    std::vector<std::string> latest = BackupManager::latest_set(backupDir, paths, err);
+    CHECK(latest.size() == 2);
+    CHECK(latest.size() == 2 && latest[0].find(newer) != std::string::npos &&
+          latest[1].find(newer) != std::string::npos);
+
+    // The newest set loses a file: it is never restored, explicitly or as latest
+    std::error_code ec;
+    fs::remove(latest[1], ec);
+    latest = BackupManager::latest_set(backupDir, paths, err);
+    CHECK(latest.size() == 2 && latest[0].find(older) != std::string::npos);
+    CHECK(BackupManager::find_set(backupDir, paths, newer, err).empty());
+    CHECK(!err.empty());
+    CHECK(BackupManager::find_set(backupDir, paths, "20000101-000000-000-0000", err).empty());
+
+    // Restoring the older set brings back both files as of that run
+    std::string restored = dir.file("restored.db");
+    CHECK(BackupManager::restore(latest[0], restored, err));
+    sqlite3* r = Database::init(restored);
+    CHECK(r != nullptr);
+    if (r) {
+        CHECK(query_int(r, "SELECT COUNT(*) FROM users;") == 1);
+        sqlite3_close(r);
+    }
+
+    sqlite3_close(a);
+    sqlite3_close(b);
+}
+
+static void test_retention_counts_sets() {
+    TempDir dir("backup-keep");
+    std::vector<std::string> paths = {dir.file("users.shard0.db"), dir.file("users.router.db")};
+    std::string backupDir = dir.file("backups");
+
+    sqlite3* a = Database::init(paths[0]);
+    sqlite3* b = Database::init_router(paths[1]);
+    CHECK(a != nullptr && b != nullptr);
+    if (!a || !b) return;
+
+    {
+        BackupManager backups({a, b}, paths, backupDir, 2, std::chrono::minutes(0));
+        for (int i = 0; i < 3; ++i) {
+            CHECK(backup_now(backups));
+        }
+        CHECK(count_snapshots(backupDir) == 4);     // two sets of two files
+
+        // A partial set (one file of a run cut short) is pruned by the next success
+        std::string err;
+        std::vector<std::string> latest = BackupManager::latest_set(backupDir, paths, err);
+        CHECK(latest.size() == 2);
+        if (latest.size() == 2) {
+            fs::copy_file(latest[0], backupDir + "/users.shard0-20000101-000000-000-0000.db.gz");
+        }
+        CHECK(count_snapshots(backupDir) == 5);
+        CHECK(backup_now(backups));
+        CHECK(count_snapshots(backupDir) == 4);
+    }
+
+    sqlite3_close(a);
+    sqlite3_close(b);
+}
+
+int main() {
+    test_sets_are_complete_and_restorable();
+    test_retention_counts_sets();
+    return finish("backup_test");
+}
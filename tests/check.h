@@ -0,0 +1,76 @@
+#pragma once
+// Minimal test support shared by tests/*_test.cpp: CHECK records a failure
+// and carries on, finish() reports and gives the process exit code.
+#include <sqlite3.h>
+
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                 \
+    do {                                                                            \
+        if (!(cond)) {                                                              \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" \
+                      << std::endl;                                                 \
+            failures++;                                                             \
+        }                                                                           \
+    } while (0)
+
+inline int finish(const char* suite) {
+    if (failures > 0) {
+        std::cerr << suite << ": " << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << suite << ": all checks passed" << std::endl;
+    return 0;
+}
+
+// A fresh directory per test, removed afterwards
+class TempDir {
+public:
+    explicit TempDir(const std::string& name)
+        : path_(std::filesystem::temp_directory_path() /
+                ("test-" + std::to_string(getpid()) + "-" + name)) {
+        std::filesystem::remove_all(path_);
+        std::filesystem::create_directories(path_);
+    }
+    ~TempDir() {
+        std::error_code ec;
+        std::filesystem::remove_all(path_, ec);
+    }
+
+    const std::filesystem::path& path() const { return path_; }
+    std::string file(const std::string& name) const { return (path_ / name).string(); }
+
+private:
+    std::filesystem::path path_;
+};
+
+inline bool exec(sqlite3* db, const std::string& sql) {
+    return sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+}
+
+// First column of the first row; -1 if there is none
+inline long long query_int(sqlite3* db, const std::string& sql) {
+    sqlite3_stmt* stmt = nullptr;
+    long long value = -1;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK &&
+        sqlite3_step(stmt) == SQLITE_ROW) {
+        value = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return value;
+}
+
+inline bool insert_user(sqlite3* db, long long id, const std::string& email) {
+    return exec(db, "INSERT INTO users (id, firstName, lastName, email, passwordHash) VALUES (" +
+                        std::to_string(id) + ", 'Test', 'User', '" + email + "', 'x');");
+}
+
+inline bool insert_account(sqlite3* db, long long id, long long userId) {
+    return exec(db, "INSERT INTO accounts (id, userId, type, status) VALUES (" + std::to_string(id) + ", " +
+                        std::to_string(userId) + ", 'checking', 'active');");
+}
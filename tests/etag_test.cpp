@@ -0,0 +1,75 @@
+// Conditional GET: If-None-Match matching and the collection versions the
+// list ETags are derived from.
+#include "check.h"
+#include "http/ETag.h"
+#include "repository/Database.h"
+
+static long long entity_version(sqlite3* db, const std::string& entity) {
+    return query_int(db, "SELECT version FROM entity_versions WHERE entity = '" + entity + "';");
+}
+
+static void test_make() {
+    CHECK(ETag::make("user-3", 7) == "\"user-3-v7\"");
+}
+
+static void test_matches() {
+    const std::string etag = ETag::make("user-3", 7);
+
+    CHECK(!ETag::matches("", etag));
+    CHECK(ETag::matches("\"user-3-v7\"", etag));
+    CHECK(!ETag::matches("\"user-3-v6\"", etag));
+    CHECK(!ETag::matches("user-3-v7", etag));          // unquoted is a different tag
+
+    CHECK(ETag::matches("W/\"user-3-v7\"", etag));     // weak comparison
+    CHECK(ETag::matches("*", etag));
+
+    CHECK(ETag::matches("\"a-v1\", \"user-3-v7\"", etag));
+    CHECK(ETag::matches("\"a-v1\",W/\"user-3-v7\" ,\"b-v2\"", etag));
+    CHECK(ETag::matches(" \t\"user-3-v7\"\t ", etag));
+    CHECK(!ETag::matches("\"a-v1\", \"b-v2\"", etag));
+    CHECK(!ETag::matches(",, ,", etag));
+}
+
+// Every insert, update and delete moves its table's version, including the
+// balance updates made by the ledger trigger
+static void test_entity_versions() {
+    TempDir dir("versions");
+    sqlite3* db = Database::init(dir.file("users.db"));
+    CHECK(db != nullptr);
+    if (!db) return;
+
+    CHECK(entity_version(db, "users") == 0);
+    CHECK(entity_version(db, "accounts") == 0);
+
+    CHECK(insert_user(db, 1, "a@example.com"));
+    CHECK(entity_version(db, "users") == 1);
+
+    CHECK(exec(db, "UPDATE users SET firstName = 'B' WHERE id = 1;"));
+    CHECK(entity_version(db, "users") == 2);
+
+    CHECK(insert_account(db, 1, 1));
+    CHECK(entity_version(db, "accounts") == 1);
+    CHECK(entity_version(db, "users") == 2);
+
+    CHECK(exec(db, "INSERT INTO transactions (accountId, amountCents, balanceAfterCents) VALUES (1, 100, 100);"));
+    CHECK(entity_version(db, "accounts") == 2);
+
+    CHECK(exec(db, "DELETE FROM accounts WHERE id = 1;"));
+    CHECK(entity_version(db, "accounts") == 3);
+
+    // Statements that change nothing leave the version alone
+    CHECK(exec(db, "UPDATE users SET firstName = 'C' WHERE id = 99;"));
+    CHECK(entity_version(db, "users") == 2);
+
+    CHECK(exec(db, "DELETE FROM users WHERE id = 1;"));
+    CHECK(entity_version(db, "users") == 3);
+
+    sqlite3_close(db);
+}
+
+int main() {
+    test_make();
+    test_matches();
+    test_entity_versions();
+    return finish("etag_test");
+}
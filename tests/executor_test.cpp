@@ -0,0 +1,39 @@
+// DbExecutor: bounded queues, separate read and write limits, and a
+// shutdown that runs what was queued and refuses the rest.
+#include "check.h"
+#include "repository/DbExecutor.h"
+
+#include <future>
+
+static void test_rejects_when_full() {
+    DbExecutor executor(1, 1, 1);
+
+    std::promise<void> started;
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+
+    CHECK(executor.submit(DbExecutor::Kind::Write, [&started, released] {
+        started.set_value();
+        released.wait();
+    }));
+    started.get_future().wait();
+
+    int ran = 0;
+    CHECK(executor.submit(DbExecutor::Kind::Write, [&ran] { ran++; }));     // queued
+    CHECK(!executor.accepting(DbExecutor::Kind::Write));
+    CHECK(!executor.submit(DbExecutor::Kind::Write, [&ran] { ran++; }));    // full
+    CHECK(executor.accepting(DbExecutor::Kind::Read));                      // queues are separate
+    CHECK(executor.pending() == 2);
+
+    release.set_value();
+    executor.shutdown();
+    CHECK(ran == 1);
+    CHECK(executor.stats(DbExecutor::Kind::Write).rejected == 1);
+    CHECK(!executor.submit(DbExecutor::Kind::Read, [] {}));                 // after shutdown
+    executor.shutdown();                                                    // idempotent
+}
+
+int main() {
+    test_rejects_when_full();
+    return finish("executor_test");
+}
@@ -0,0 +1,112 @@
+// The existence index: membership and counts, accounts per user, id bounds,
+// loading from a shard, and concurrent writers.
+#include "check.h"
+#include "repository/Database.h"
+#include "repository/ExistenceIndex.h"
+
+#include <thread>
+#include <vector>
+
+static void test_add_and_remove() {
+    ExistenceIndex index;
+    CHECK(!index.has_user(1));
+    CHECK(index.user_count() == 0);
+
+    index.add_user(1);
+    index.add_user(1);      // idempotent
+    index.add_user(100000);
+    CHECK(index.has_user(1) && index.has_user(100000));
+    CHECK(!index.has_user(2));
+    CHECK(index.user_count() == 2);
+
+    index.add_account(10, 1);
+    index.add_account(11, 1);
+    index.add_account(11, 1);
+    CHECK(index.has_account(10) && index.has_account(11));
+    CHECK(index.account_count() == 2);
+    CHECK(index.user_has_accounts(1));
+    CHECK(!index.user_has_accounts(100000));
+
+    index.remove_account(10, 1);
+    CHECK(index.user_has_accounts(1));
+    index.remove_account(11, 1);
+    index.remove_account(11, 1);    // already gone: the count stays at zero
+    CHECK(!index.user_has_accounts(1));
+    CHECK(index.account_count() == 0);
+
+    index.remove_user(1);
+    CHECK(!index.has_user(1));
+    CHECK(index.user_count() == 1);
+}
+
+static void test_id_bounds() {
+    ExistenceIndex index;
+    index.add_user(0);
+    index.add_user(-5);
+    CHECK(index.user_count() == 0);
+    CHECK(!index.has_user(0) && !index.has_user(-5));
+
+    // Largest 31-bit id works; beyond the index's range is simply absent
+    index.add_user(2147483647LL);
+    CHECK(index.has_user(2147483647LL));
+    index.add_user(1LL << 40);
+    CHECK(!index.has_user(1LL << 40));
+    CHECK(index.user_count() == 1);
+}
+
+static void test_load_from_shard() {
+    TempDir dir("existence");
+    sqlite3* db = Database::init(dir.file("users.db"));
+    CHECK(db != nullptr);
+    if (!db) return;
+
+    CHECK(insert_user(db, 3, "a@example.com"));
+    CHECK(insert_user(db, 4, "b@example.com"));
+    CHECK(insert_account(db, 7, 3));
+
+    ExistenceIndex index;
+    CHECK(index.load(db));
+    CHECK(index.has_user(3) && index.has_user(4));
+    CHECK(index.has_account(7));
+    CHECK(index.user_has_accounts(3) && !index.user_has_accounts(4));
+    CHECK(index.user_count() == 2 && index.account_count() == 1);
+
+    sqlite3_close(db);
+}
+
+// Writers racing on the same words and pages lose no bits and no counts
+static void test_concurrent_writers() {
+    ExistenceIndex index;
+    const int threads = 8;
+    const int perThread = 20000;
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&index, t] {
+            for (int i = 0; i < perThread; ++i) {
+                long long id = static_cast<long long>(i) * threads + t + 1;
+                index.add_user(id);
+                index.add_account(id, 1);
+            }
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+
+    CHECK(index.user_count() == static_cast<std::size_t>(threads * perThread));
+    CHECK(index.account_count() == static_cast<std::size_t>(threads * perThread));
+    bool all = true;
+    for (long long id = 1; id <= threads * perThread; ++id) {
+        all = all && index.has_user(id) && index.has_account(id);
+    }
+    CHECK(all);
+}
+
+int main() {
+    test_add_and_remove();
+    test_id_bounds();
+    test_load_from_shard();
+    test_concurrent_writers();
+    return finish("existence_index_test");
+}
@@ -0,0 +1,83 @@
+// The /ready database probe: healthy after a SELECT 1 through the executor,
+// unhealthy while no probe has finished or once the last one is too old.
+#include "check.h"
+#include "repository/Database.h"
+#include "repository/DbExecutor.h"
+#include "repository/HealthProbe.h"
+
+#include <chrono>
+#include <thread>
+
+static bool wait_healthy(const HealthProbe& probe, std::chrono::milliseconds maxAge) {
+    std::string reason;
+    for (int i = 0; i < 200; ++i) {
+        if (probe.check(maxAge, reason)) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+static void test_probe_reports_health() {
+    TempDir dir("probe");
+    sqlite3* db = Database::init(dir.file("users.db"));
+    CHECK(db != nullptr);
+    if (!db) return;
+
+    DbExecutor executor(1, 1, 8);
+    {
+        HealthProbe probe({db},
+                          [&executor](std::function<void()> job) {
+                              return executor.submit(DbExecutor::Kind::Read, std::move(job));
+                          },
+                          std::chrono::milliseconds(20));
+        CHECK(wait_healthy(probe, std::chrono::seconds(5)));
+
+        // Queue shut down: probes stop finishing, so the last result goes stale
+        executor.shutdown();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        std::string reason;
+        CHECK(!probe.check(std::chrono::milliseconds(50), reason));
+        CHECK(reason.find("ago") != std::string::npos);
+    }
+
+    sqlite3_close(db);
+}
+
+static void test_probe_needs_a_result() {
+    // Nothing ever runs the job: never healthy
+    HealthProbe probe({}, [](std::function<void()>) { return true; }, std::chrono::milliseconds(20));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::string reason;
+    CHECK(!probe.check(std::chrono::seconds(5), reason));
+    CHECK(!reason.empty());
+}
+
+static void test_probe_reports_failures() {
+    TempDir dir("probe-fail");
+    sqlite3* db = Database::init(dir.file("users.db"));
+    CHECK(db != nullptr);
+    if (!db) return;
+
+    // A handle whose file could not be opened fails every statement; jobs run inline
+    sqlite3* closed = nullptr;
+    CHECK(sqlite3_open_v2(dir.file("missing/x.db").c_str(), &closed, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK);
+
+    HealthProbe probe({db, closed}, [](std::function<void()> job) { job(); return true; },
+                      std::chrono::milliseconds(20));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::string reason;
+    CHECK(!probe.check(std::chrono::seconds(5), reason));
+    CHECK(reason.find("database probe failed") != std::string::npos);
+
+    sqlite3_close(closed);
+    sqlite3_close(db);
+}
+
+int main() {
+    test_probe_reports_health();
+    test_probe_needs_a_result();
+    test_probe_reports_failures();
+    return finish("health_probe_test");
+}
@@ -0,0 +1,148 @@
+// The balance ledger: transactions are append-only and always sum to the
+// account's balanceCents.
+#include "check.h"
+#include "repository/Database.h"
+
+static void test_ledger_sums_to_balance() {
+    TempDir dir("ledger");
+    sqlite3* db = Database::init(dir.file("users.db"));
+    CHECK(db != nullptr);
+    if (!db) return;
+
+    CHECK(insert_user(db, 1, "a@example.com"));
+    CHECK(insert_account(db, 1, 1));
+
+    const std::string balance = "SELECT balanceCents FROM accounts WHERE id = 1;";
+    const std::string ledgerSum = "SELECT COALESCE(SUM(amountCents), 0) FROM transactions WHERE accountId = 1;";
+    const std::string rows = "SELECT COUNT(*) FROM transactions WHERE accountId = 1;";
+
+    CHECK(Database::record_balance_adjustment(db, 1, 50000, "Opening balance", true) == SQLITE_DONE);
+    CHECK(query_int(db, balance) == 50000);
+
+    CHECK(exec(db, "INSERT INTO transactions (accountId, amountCents, balanceAfterCents, description) "
+                   "VALUES (1, -12345, 37655, 'Withdrawal');"));
+    CHECK(query_int(db, balance) == 37655);
+
+    CHECK(Database::record_balance_adjustment(db, 1, 100, "Balance adjustment", true) == SQLITE_DONE);
+    CHECK(query_int(db, balance) == 100);
+    CHECK(query_int(db, "SELECT balanceAfterCents FROM transactions ORDER BY id DESC LIMIT 1;") == 100);
+
+    // Adjusting to the current balance writes no row
+    long long before = query_int(db, rows);
+    CHECK(Database::record_balance_adjustment(db, 1, 100, "Balance adjustment", true) == SQLITE_DONE);
+    CHECK(query_int(db, rows) == before);
+
+    CHECK(query_int(db, ledgerSum) == query_int(db, balance));
+
+    sqlite3_close(db);
+}
+
+static void test_ledger_is_append_only() {
+    TempDir dir("append-only");
+    sqlite3* db = Database::init(dir.file("users.db"));
+    CHECK(db != nullptr);
+    if (!db) return;
+
+    CHECK(insert_user(db, 1, "a@example.com"));
+    CHECK(insert_account(db, 1, 1));
+    CHECK(Database::record_balance_adjustment(db, 1, 700, "Opening balance", true) == SQLITE_DONE);
+
+    CHECK(!exec(db, "UPDATE transactions SET amountCents = 1;"));
+    CHECK(!exec(db, "DELETE FROM transactions;"));
+    CHECK(query_int(db, "SELECT SUM(amountCents) FROM transactions;") == 700);
+
+    sqlite3_close(db);
+}
+
+// PATCH passes includeLocked = false: a locked account's balance stays put even
+// if the route's own status check raced with a lock
+static void test_adjustment_skips_locked_accounts() {
+    TempDir dir("locked");
+    sqlite3* db = Database::init(dir.file("users.db"));
+    CHECK(db != nullptr);
+    if (!db) return;
+
+    CHECK(insert_user(db, 1, "a@example.com"));
+    CHECK(insert_account(db, 1, 1));
+    CHECK(Database::record_balance_adjustment(db, 1, 500, "Opening balance", true) == SQLITE_DONE);
+    CHECK(exec(db, "UPDATE accounts SET status = 'locked' WHERE id = 1;"));
+
+    CHECK(Database::record_balance_adjustment(db, 1, 900, "Balance adjustment", false) == SQLITE_DONE);
+    CHECK(query_int(db, "SELECT balanceCents FROM accounts WHERE id = 1;") == 500);
+    CHECK(query_int(db, "SELECT COUNT(*) FROM transactions;") == 1);
+
+    sqlite3_close(db);
+}
+
+// An uncommitted Transaction leaves neither the account nor its ledger row
+static void test_transaction_rolls_back_unless_committed() {
+    TempDir dir("txn");
+    sqlite3* db = Database::init(dir.file("users.db"));
+    CHECK(db != nullptr);
+    if (!db) return;
+
+    CHECK(insert_user(db, 1, "a@example.com"));
+    {
+        Transaction txn(db);
+        CHECK(txn.active());
+        CHECK(insert_account(db, 1, 1));
+        CHECK(Database::record_balance_adjustment(db, 1, 250, "Opening balance", true) == SQLITE_DONE);
+    }
+    CHECK(query_int(db, "SELECT COUNT(*) FROM accounts;") == 0);
+    CHECK(query_int(db, "SELECT COUNT(*) FROM transactions;") == 0);
+
+    {
+        Transaction txn(db);
+        CHECK(insert_account(db, 1, 1));
+        CHECK(Database::record_balance_adjustment(db, 1, 250, "Opening balance", true) == SQLITE_DONE);
+        CHECK(txn.commit());
+    }
+    CHECK(query_int(db, "SELECT balanceCents FROM accounts WHERE id = 1;") == 250);
+    CHECK(query_int(db, "SELECT COUNT(*) FROM transactions;") == 1);
+
+    sqlite3_close(db);
+}
+
+// A file from before the ledger (REAL balances only) gets cents and one
+// opening row per funded account, exactly once
+static void test_legacy_balances_are_migrated() {
+    TempDir dir("legacy");
+    std::string path = dir.file("users.db");
+    {
+        sqlite3* db = nullptr;
+        CHECK(sqlite3_open(path.c_str(), &db) == SQLITE_OK);
+        CHECK(exec(db, "CREATE TABLE users (id INTEGER PRIMARY KEY AUTOINCREMENT, firstName TEXT NOT NULL, "
+                       "lastName TEXT NOT NULL, email TEXT NOT NULL UNIQUE, passwordHash TEXT NOT NULL, "
+                       "createdAt TIMESTAMP DEFAULT CURRENT_TIMESTAMP, updatedAt TIMESTAMP DEFAULT CURRENT_TIMESTAMP);"));
+        CHECK(exec(db, "CREATE TABLE accounts (id INTEGER PRIMARY KEY AUTOINCREMENT, userId INTEGER NOT NULL, "
+                       "type TEXT NOT NULL, status TEXT NOT NULL, balance REAL NOT NULL DEFAULT 0, "
+                       "createdAt TIMESTAMP DEFAULT CURRENT_TIMESTAMP, updatedAt TIMESTAMP DEFAULT CURRENT_TIMESTAMP);"));
+        CHECK(insert_user(db, 1, "a@example.com"));
+        CHECK(exec(db, "INSERT INTO accounts (id, userId, type, status, balance) VALUES "
+                       "(1, 1, 'checking', 'active', 12.34), (2, 1, 'savings', 'active', 0), "
+                       "(3, 1, 'savings', 'locked', 0.1);"));
+        sqlite3_close(db);
+    }
+
+    for (int start = 0; start < 2; ++start) {
+        sqlite3* db = Database::init(path);
+        CHECK(db != nullptr);
+        if (!db) return;
+
+        CHECK(query_int(db, "SELECT balanceCents FROM accounts WHERE id = 1;") == 1234);
+        CHECK(query_int(db, "SELECT balanceCents FROM accounts WHERE id = 3;") == 10);
+        CHECK(query_int(db, "SELECT COUNT(*) FROM transactions;") == 2);
+        CHECK(query_int(db, "SELECT COUNT(*) FROM accounts a WHERE a.balanceCents <> "
+                            "(SELECT COALESCE(SUM(amountCents), 0) FROM transactions t WHERE t.accountId = a.id);") == 0);
+        sqlite3_close(db);
+    }
+}
+
+int main() {
+    test_legacy_balances_are_migrated();
+    test_ledger_sums_to_balance();
+    test_ledger_is_append_only();
+    test_adjustment_skips_locked_accounts();
+    test_transaction_rolls_back_unless_committed();
+    return finish("ledger_test");
+}
@@ -0,0 +1,93 @@
+// MaintenanceScheduler: work waits for a quiet window measured in pending
+// database jobs, then gathers statistics on the file.
+#include "check.h"
+#include "repository/Database.h"
+#include "repository/Maintenance.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+static bool wait_for_runs(const MaintenanceScheduler& maintenance, int runs, std::chrono::milliseconds limit) {
+    auto deadline = std::chrono::steady_clock::now() + limit;
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (maintenance.stats()[0].runs >= runs) return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    return false;
+}
+
+static void test_waits_for_quiet() {
+    TempDir dir("maintenance");
+    sqlite3* db = Database::init(dir.file("users.db"));
+    CHECK(db != nullptr);
+    if (!db) return;
+
+    std::atomic<int> pending{3};
+    MaintenanceScheduler::Options options;
+    options.interval = std::chrono::minutes(0);
+    options.idleWindow = std::chrono::milliseconds(300);
+
+    {
+        MaintenanceScheduler maintenance({db}, {"users.db"}, options, [&pending] { return pending.load(); });
+        maintenance.trigger();
+
+        CHECK(!wait_for_runs(maintenance, 1, std::chrono::milliseconds(1000)));
+
+        pending = 0;
+        CHECK(wait_for_runs(maintenance, 1, std::chrono::milliseconds(3000)));
+        MaintenanceStats st = maintenance.stats()[0];
+        CHECK(st.lastError.empty());
+        CHECK(st.analyzed);
+        CHECK(st.autoVacuum == "incremental");
+    }
+
+    sqlite3_close(db);
+}
+
+// A file created without auto_vacuum=INCREMENTAL is converted only on request
+static void test_auto_vacuum_conversion() {
+    TempDir dir("auto-vacuum");
+    sqlite3* db = nullptr;
+    CHECK(sqlite3_open(dir.file("old.db").c_str(), &db) == SQLITE_OK);
+    CHECK(exec(db, "CREATE TABLE t (x); INSERT INTO t VALUES (1);"));
+
+    MaintenanceScheduler::Options options;
+    options.interval = std::chrono::minutes(0);
+    {
+        MaintenanceScheduler maintenance({db}, {"old.db"}, options, [] { return 0; });
+    }
+    CHECK(query_int(db, "PRAGMA auto_vacuum;") == 0);
+
+    options.convertAutoVacuum = true;
+    {
+        MaintenanceScheduler maintenance({db}, {"old.db"}, options, [] { return 0; });
+    }
+    CHECK(query_int(db, "PRAGMA auto_vacuum;") == 2);
+    CHECK(query_int(db, "SELECT x FROM t;") == 1);
+
+    sqlite3_close(db);
+}
+
+// Shards and router are all created ready for incremental vacuum
+static void test_new_files_are_incremental() {
+    TempDir dir("new-files");
+    sqlite3* db = Database::init(dir.file("users.db"));
+    sqlite3* router = Database::init_router(dir.file("users.router.db"));
+    CHECK(db != nullptr);
+    CHECK(router != nullptr);
+    if (!db || !router) return;
+
+    CHECK(query_int(db, "PRAGMA auto_vacuum;") == 2);
+    CHECK(query_int(router, "PRAGMA auto_vacuum;") == 2);
+
+    sqlite3_close(db);
+    sqlite3_close(router);
+}
+
+int main() {
+    test_new_files_are_incremental();
+    test_waits_for_quiet();
+    test_auto_vacuum_conversion();
+    return finish("maintenance_test");
+}
@@ -0,0 +1,176 @@
+// Sharded storage: stable routing, account id allocation, the router's
+// email uniqueness and its repair on open, and refused layout changes.
+#include "check.h"
+#include "repository/Database.h"
+#include "repository/ShardSet.h"
+
+#include <set>
+
+static void test_shard_routing() {
+    TempDir dir("routing");
+    auto shards = ShardSet::open(dir.file("users.db"), 4, {});
+    CHECK(shards != nullptr);
+    if (!shards) return;
+
+    CHECK(shards->size() == 4);
+    CHECK(shards->connections().size() == 5);   // shards + router
+
+    std::set<size_t> used;
+    for (long long userId = 1; userId <= 1000; ++userId) {
+        size_t shard = shards->shard_of_user(userId);
+        CHECK(shard < 4);
+        CHECK(shard == shards->shard_of_user(userId));
+        used.insert(shard);
+    }
+    CHECK(used.size() == 4);
+
+    // Account ids handed out for a shard route back to it, and are never reused
+    for (size_t shard = 0; shard < 4; ++shard) {
+        sqlite3* db = shards->shard(shard);
+        long long userId = static_cast<long long>(shard) + 1;
+        CHECK(insert_user(db, userId, "u" + std::to_string(shard) + "@example.com"));
+
+        long long previous = 0;
+        for (int i = 0; i < 3; ++i) {
+            long long id = shards->next_account_id(shard);
+            CHECK(id > previous);
+            CHECK(shards->shard_of_account(id) == shard);
+            CHECK(insert_account(db, id, userId));
+            previous = id;
+        }
+        CHECK(exec(db, "DELETE FROM accounts WHERE id = " + std::to_string(previous) + ";"));
+        CHECK(shards->next_account_id(shard) > previous);
+    }
+}
+
+static void test_router_email_uniqueness() {
+    TempDir dir("router");
+    auto shards = ShardSet::open(dir.file("users.db"), 2, {});
+    CHECK(shards != nullptr);
+    if (!shards) return;
+
+    long long first = 0;
+    long long second = 0;
+    CHECK(shards->reserve_user("a@example.com", first) == SQLITE_OK);
+    CHECK(shards->reserve_user("a@example.com", second) == SQLITE_CONSTRAINT);
+    CHECK(shards->user_id_for_email("a@example.com") == first);
+
+    CHECK(shards->reserve_user("b@example.com", second) == SQLITE_OK);
+    CHECK(second != first);
+
+    std::string previous;
+    CHECK(shards->update_user_email(second, "a@example.com", previous) != SQLITE_OK);
+    CHECK(shards->update_user_email(second, "c@example.com", previous) == SQLITE_OK);
+    CHECK(previous == "b@example.com");
+    CHECK(shards->user_id_for_email("b@example.com") == 0);
+}
+
+// A reservation whose shard insert never happened (crash in between) is
+// released on the next start; router emails follow the shard's value
+static void test_router_reconciles_on_open() {
+    TempDir dir("reconcile");
+    std::string path = dir.file("users.db");
+
+    long long kept = 0;
+    long long moved = 0;
+    long long stale = 0;
+    {
+        auto shards = ShardSet::open(path, 2, {});
+        CHECK(shards != nullptr);
+        if (!shards) return;
+
+        CHECK(shards->reserve_user("kept@example.com", kept) == SQLITE_OK);
+        CHECK(insert_user(shards->for_user(kept), kept, "kept@example.com"));
+
+        CHECK(shards->reserve_user("old@example.com", moved) == SQLITE_OK);
+        CHECK(insert_user(shards->for_user(moved), moved, "new@example.com"));
+
+        CHECK(shards->reserve_user("stale@example.com", stale) == SQLITE_OK);
+    }
+
+    auto shards = ShardSet::open(path, 2, {});
+    CHECK(shards != nullptr);
+    if (!shards) return;
+
+    CHECK(shards->user_id_for_email("kept@example.com") == kept);
+    CHECK(shards->user_id_for_email("new@example.com") == moved);
+    CHECK(shards->user_id_for_email("old@example.com") == 0);
+    CHECK(shards->user_id_for_email("stale@example.com") == 0);
+
+    long long again = 0;
+    CHECK(shards->reserve_user("stale@example.com", again) == SQLITE_OK);
+}
+
+// A router that lost rows (e.g. restored from an older backup) gets a route
+// back for every shard user, and new ids start above all of them
+static void test_router_restores_missing_routes() {
+    TempDir dir("missing-routes");
+    std::string path = dir.file("users.db");
+    {
+        auto shards = ShardSet::open(path, 2, {});
+        CHECK(shards != nullptr);
+        if (!shards) return;
+
+        for (long long id = 1; id <= 5; ++id) {
+            CHECK(insert_user(shards->for_user(id), id, "u" + std::to_string(id) + "@example.com"));
+        }
+        CHECK(exec(shards->router(), "DELETE FROM user_routes;"));
+        CHECK(exec(shards->router(), "DELETE FROM sqlite_sequence;"));
+        long long id = 0;
+        CHECK(shards->reserve_user("u3@example.com", id) == SQLITE_OK);    // router sequence restarted at 1
+        CHECK(id == 1);
+    }
+
+    auto shards = ShardSet::open(path, 2, {});
+    CHECK(shards != nullptr);
+    if (!shards) return;
+
+    for (long long id = 1; id <= 5; ++id) {
+        CHECK(shards->user_id_for_email("u" + std::to_string(id) + "@example.com") == id);
+    }
+
+    long long next = 0;
+    CHECK(shards->reserve_user("new@example.com", next) == SQLITE_OK);
+    CHECK(next > 5);
+}
+
+static void test_layout_changes_are_refused() {
+    {
+        TempDir dir("unsharded-data");
+        std::string path = dir.file("users.db");
+        sqlite3* db = Database::init(path);
+        CHECK(db != nullptr);
+        if (!db) return;
+        CHECK(insert_user(db, 1, "a@example.com"));
+        sqlite3_close(db);
+
+        CHECK(ShardSet::open(path, 4, {}) == nullptr);
+        CHECK(!std::filesystem::exists(dir.file("users.shard0.db")));
+        CHECK(ShardSet::open(path, 1, {}) != nullptr);
+    }
+    {
+        TempDir dir("sharded-data");
+        std::string path = dir.file("users.db");
+        {
+            auto shards = ShardSet::open(path, 2, {});
+            CHECK(shards != nullptr);
+            if (!shards) return;
+            long long userId = 0;
+            CHECK(shards->reserve_user("a@example.com", userId) == SQLITE_OK);
+            CHECK(insert_user(shards->for_user(userId), userId, "a@example.com"));
+        }
+
+        CHECK(ShardSet::open(path, 1, {}) == nullptr);
+        CHECK(ShardSet::open(path, 3, {}) == nullptr);
+        CHECK(ShardSet::open(path, 2, {}) != nullptr);
+    }
+}
+
+int main() {
+    test_shard_routing();
+    test_router_email_uniqueness();
+    test_router_reconciles_on_open();
+    test_router_restores_missing_routes();
+    test_layout_changes_are_refused();
+    return finish("shard_test");
+}